@@ -0,0 +1,102 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "data_sizes.h"
+
+struct cpu;
+
+enum block_cache_sizes
+{
+    BLOCK_CACHE_SIZE = 1024, // direct mapped on the block address
+    BLOCK_MAX_OPS = 32,
+    BLOCK_CODE_PAGE_SHIFT = 8,
+    BLOCK_CODE_PAGE_COUNT = 1 << 16, // hashed, a collision only costs an extra invalidation scan
+    BLOCK_IDLE_MAX_OPS = 8, // longest loop body, branch included, checked for idling
+    BLOCK_IDLE_OVERRIDE_COUNT = 16,
+};
+
+struct block_op
+{
+    union
+    {
+        void (*arm)(struct cpu *cpu, WORD instruction);
+        void (*thumb)(struct cpu *cpu, HALF_WORD instruction);
+    } execute;
+    WORD instruction;
+    WORD imm;
+    BYTE condition;
+    BYTE rd;
+    BYTE rn;
+    BYTE rm;
+    BYTE cycles;
+    bool increments_pc;
+};
+
+struct block
+{
+    WORD address;
+    WORD end; // first address after the block
+    int op_count;
+    int cycles; // sum of the cycles of every op
+    bool valid;
+    bool thumb;
+    bool idle; // branches back to itself without changing anything a second pass would see
+    struct block_op ops[BLOCK_MAX_OPS];
+};
+
+struct block_cache
+{
+    struct block *blocks;
+    uint64_t code_pages[BLOCK_CODE_PAGE_COUNT / 64];
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidations;
+    bool idle_detection;
+    WORD idle_overrides[BLOCK_IDLE_OVERRIDE_COUNT]; // loop addresses treated as idle without analysis
+    int idle_override_count;
+    uint64_t idle_skips;
+    uint64_t idle_cycles_skipped;
+};
+
+// idle loop addresses that games are known to spin on, keyed by the 4 character game code in the rom header
+struct idle_loop_override
+{
+    char game_code[4];
+    WORD address;
+};
+
+void block_cache_init(struct block_cache *cache);
+
+void block_cache_free(struct block_cache *cache);
+
+void block_cache_flush(struct block_cache *cache);
+
+struct block *block_cache_lookup(struct cpu *cpu, WORD address, bool thumb);
+
+// returns the cycles spent, a skipped conditional instruction costs one
+int block_cache_execute(struct cpu *cpu, struct block *block);
+
+void block_cache_invalidate(struct block_cache *cache, WORD address, WORD size);
+
+bool block_cache_add_idle_override(struct block_cache *cache, WORD address);
+
+// drops the overrides of the previous game
+void block_cache_clear_idle_overrides(struct block_cache *cache);
+
+// adds every known idle loop for the game, returns how many were added
+int block_cache_load_idle_overrides(struct block_cache *cache, const char *game_code);
+
+static inline bool block_cache_is_code(struct block_cache *cache, WORD address)
+{
+    WORD page = (address >> BLOCK_CODE_PAGE_SHIFT) & (BLOCK_CODE_PAGE_COUNT - 1);
+    return (cache->code_pages[page / 64] >> (page % 64)) & 0b1;
+}
+
+// called on every store, only scans the cache when the store hits a page holding cached code
+static inline void block_cache_write(struct block_cache *cache, WORD address, WORD size)
+{
+    if (block_cache_is_code(cache, address) || block_cache_is_code(cache, address + size - 1))
+    {
+        block_cache_invalidate(cache, address, size);
+    }
+}
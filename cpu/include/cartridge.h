@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "data_sizes.h"
+
+enum cartridge_header
+{
+    CARTRIDGE_GAME_CODE = 0xAC,
+    CARTRIDGE_GAME_CODE_SIZE = 4,
+    CARTRIDGE_HEADER_SIZE = 0xC0,
+};
+
+// a rom image, mapped straight from its file where the host allows it so the page cache is shared with every
+// other process that has the same file open
+struct cartridge
+{
+    BYTE *data; // NULL until a rom is loaded, zero padded to a whole number of memory map pages
+    WORD size; // bytes of the file that were loaded
+    size_t reserved; // bytes behind data
+    bool mapped; // false when the file had to be read into the heap
+    int fd; // the file data is mapped from, kept open so fastmem can map it too, -1 when it was read
+};
+
+// false when the file cannot be opened or read, the cartridge is left empty
+bool cartridge_load(struct cartridge *cartridge, const char *path);
+
+void cartridge_unload(struct cartridge *cartridge);
@@ -12,23 +12,20 @@
 #include "instructions.h"
 #include "syscall.h"
 #include "requests.h"
+#include "block_cache.h"
+#include "scheduler.h"
+#include "memory_map.h"
+#include "cartridge.h"
 #ifndef NULL
     #define NULL 0
 #endif
 
-enum memory_sections_size
+// where the bios leaves each mode's stack, at the top of iwram
+enum stack_pointers
 {
-    BIOS_SIZE = 16 * KB,
-    STACK_SIZE = 1 * KB,
-    MEMORY_SIZE = STACK_SIZE + STACK_SIZE + BIOS_SIZE
-};
-
-enum memory_sections
-{
-    BIOS_START = 0x00000000,
-    BIOS_END = BIOS_START + BIOS_SIZE,
-    STACK_START = BIOS_END,
-    STACK_END = STACK_START + STACK_SIZE,
+    USER_STACK_START = 0x03007F00,
+    IRQ_STACK_START = 0x03007FA0,
+    SVC_STACK_START = 0x03007FE0,
 };
 
 enum virtual_memory_sections
@@ -152,19 +149,144 @@ enum cpu_registers
     SP_UND,
     LR_UND,
     SPSR_UND,
+    // user copies of the registers fiq banks, also used by every other mode except for sp and lr
+    R8_USR,
+    R9_USR,
+    R10_USR,
+    R11_USR,
+    R12_USR,
+    SP_USR,
+    LR_USR,
     register_count
 };
 
+enum video_timing
+{
+    CYCLES_PER_SCANLINE = 1232, // 960 cycles of drawing then 272 of hblank
+    HBLANK_START = 960,
+    VISIBLE_SCANLINES = 160,
+    SCANLINES_PER_FRAME = 228,
+    CYCLES_PER_FRAME = CYCLES_PER_SCANLINE * SCANLINES_PER_FRAME,
+};
+
+enum decode_table_sizes
+{
+    ARM_DECODE_TABLE_SIZE = 1 << 12, // bits 27-20 and 7-4 of the instruction
+    THUMB_DECODE_TABLE_SIZE = 1 << 10, // bits 15-6 of the instruction
+};
+
+// table index built from bits 27-20 and 7-4, the only bits the arm instruction classes differ in
+#define ARM_DECODE_INDEX(instruction) ((((instruction) >> 16) & 0xFF0) | (((instruction) >> 4) & 0xF))
+
+// thumb instruction classes only differ in their top 10 bits
+#define THUMB_DECODE_INDEX(instruction) (((instruction) >> 6) & 0x3FF)
+
+struct cpu;
+struct jit;
+
+struct arm_decode_entry
+{
+    void (*execute)(struct cpu *cpu, WORD instruction);
+    enum arm_instruction_set type;
+    bool increments_pc;
+    BYTE cycles;
+};
+
+struct thumb_decode_entry
+{
+    void (*execute)(struct cpu *cpu, HALF_WORD instruction);
+    enum thumb_instruction_set type;
+    bool increments_pc;
+    BYTE cycles;
+};
+
+enum lazy_flag_op
+{
+    FLAGS_CLEAN, // CPSR holds the current NZCV
+    FLAGS_NZ, // N and Z come from result, C and V are unchanged
+    FLAGS_ADD, // result = op1 + op2 + carry_in, subtraction is stored as op1 + ~op2 + carry
+};
+
+// word and halfword accessors for one byte order, swapped by cpu_select_memory_accessors when the E bit changes
+struct memory_accessors
+{
+    WORD (*read_word)(struct cpu *cpu, WORD address);
+    HALF_WORD (*read_half_word)(struct cpu *cpu, WORD address);
+    void (*write_word)(struct cpu *cpu, WORD address, WORD value);
+    void (*write_half_word)(struct cpu *cpu, WORD address, HALF_WORD value);
+};
+
+// operands of the last flag setting op, only folded into CPSR when something reads NZCV
+struct lazy_flags
+{
+    enum lazy_flag_op op;
+    WORD result;
+    WORD op1;
+    WORD op2;
+    bool carry_in;
+};
+
 struct cpu
 {
+    // R0-PC and CPSR always hold the current mode's registers, the other modes' copies are
+    // swapped in and out by cpu_switch_mode
     uint32_t registers[register_count];
-    BYTE memory[MEMORY_SIZE];
-    struct request_channel *request_channels;
+    struct lazy_flags flags;
+    struct memory_map memory_map;
+    struct cartridge cartridge; // mapped at every rom wait state window
+    const struct memory_accessors *memory_accessors; // follows the E bit
+    struct request_channel *request_channels; // sorted by address, no two ranges overlap
     int request_channel_count;
     int request_channel_capacity;
+    BYTE mmio_pages[MMIO_PAGE_COUNT]; // per 4 KB, the first channel that reaches into the page
+    struct block_cache block_cache;
+    struct jit *jit; // NULL when LibCpu is built without the jit or it failed to start
+    uint64_t cycles; // total cycles run since cpu_init
+    struct scheduler scheduler;
+    bool hle_syscalls; // run bios calls with a native version in c instead of through the bios
+    uint64_t lle_syscalls; // one bit per gba_syscall_number, always sent to the bios
     bool isOn;
 };
 
+void cpu_fold_flags(struct cpu *cpu);
+
+// must be called before anything reads or writes NZCV in CPSR directly
+static inline void cpu_materialize_flags(struct cpu *cpu)
+{
+    if (cpu->flags.op != FLAGS_CLEAN)
+    {
+        cpu_fold_flags(cpu);
+    }
+}
+
+static inline bool cpu_carry(struct cpu *cpu)
+{
+    cpu_materialize_flags(cpu);
+    return (cpu->registers[CPSR] & C_MASK) == C_MASK;
+}
+
+// C and V are left alone, so a pending add or sub has to land in CPSR first
+static inline void cpu_set_nz_flags(struct cpu *cpu, WORD result)
+{
+    if (cpu->flags.op == FLAGS_ADD)
+    {
+        cpu_fold_flags(cpu);
+    }
+    cpu->flags.op = FLAGS_NZ;
+    cpu->flags.result = result;
+}
+
+static inline void cpu_set_add_flags(struct cpu *cpu, WORD op1, WORD op2, bool carry_in, WORD result)
+{
+    cpu->flags = (struct lazy_flags){.op = FLAGS_ADD, .result = result, .op1 = op1, .op2 = op2, .carry_in = carry_in};
+}
+
+// op1 - op2 - !carry_in, carry set means no borrow
+static inline void cpu_set_sub_flags(struct cpu *cpu, WORD op1, WORD op2, bool carry_in, WORD result)
+{
+    cpu_set_add_flags(cpu, op1, ~op2, carry_in, result);
+}
+
 enum arc_tab_taylor_series
 {
     Order_1 = 0xA2F9,
@@ -194,21 +316,35 @@ void free_cpu(struct cpu *cpu);
 
 void cpu_loop(struct cpu *cpu);
 
+// runs whole blocks up to each scheduler deadline and fires the events that are due, until cycle_budget
+// cycles have passed or the cpu is turned off, returns the cycles run
+int cpu_run(struct cpu *cpu, int cycle_budget);
+
 void cpu_print_registers(struct cpu *cpu);
 
 void cpu_print_memory(struct cpu *cpu);
 
 void cpu_print_instruction(struct cpu *cpu);
 
+void cpu_build_arm_decode_table(void);
+
+const struct arm_decode_entry *cpu_lookup_arm_instruction(WORD instruction);
+
 enum arm_instruction_set cpu_decode_arm_instruction(WORD instruction);
 
 WORD cpu_fetch_arm_instruction(struct cpu *cpu);
 
 void cpu_execute_arm_instruction(struct cpu *cpu, WORD instruction);
 
+void cpu_build_thumb_decode_table(void);
+
+const struct thumb_decode_entry *cpu_lookup_thumb_instruction(HALF_WORD instruction);
+
+enum thumb_instruction_set cpu_decode_thumb_instruction(HALF_WORD instruction);
+
 HALF_WORD cpu_fetch_thumb_instruction(struct cpu *cpu);
 
-void cpu_execute_thumb_instruction(struct cpu *cpu);
+void cpu_execute_thumb_instruction(struct cpu *cpu, HALF_WORD instruction);
 
 void arm_branch(struct cpu *cpu, WORD instruction);
 
@@ -230,6 +366,8 @@ void arm_block_data_transfer(struct cpu *cpu, WORD instruction);
 
 void arm_single_data_swap(struct cpu *cpu, WORD instruction);
 
+void arm_undefined_instruction(struct cpu *cpu, WORD instruction);
+
 void thumb_software_interrupt(struct cpu *cpu, HALF_WORD instruction);
 
 void thumb_unconditional_branch(struct cpu *cpu, HALF_WORD instruction);
@@ -268,24 +406,66 @@ void thumb_add_sub(struct cpu *cpu, HALF_WORD instruction);
 
 void thumb_move_shifted_register(struct cpu *cpu, HALF_WORD instruction);
 
+void thumb_undefined_instruction(struct cpu *cpu, HALF_WORD instruction);
+
 void cpu_switch_mode(struct cpu *cpu, enum cpu_mode mode);
 
-void add_request_channel(struct cpu *cpu, struct request_channel channel);
+// writes CPSR, swapping banked registers first when the mode changes
+void cpu_set_cpsr(struct cpu *cpu, WORD value);
+
+// the SPSR of the current mode, CPSR in user mode which has none
+int cpu_spsr_register(struct cpu *cpu);
+
+// replaces the rom, false when the file could not be loaded and the old rom is still mapped
+bool cpu_load_rom(struct cpu *cpu, const char *path);
+
+// false when the id is taken or the range overlaps a channel that is already there
+bool add_request_channel(struct cpu *cpu, struct request_channel channel);
 
 void remove_request_channel(struct cpu *cpu, struct request_channel channel);
 
+// sends the request to the channel mapped over the address, with the address made relative to the channel,
+// addresses no channel covers go to the memory behind them
+void cpu_request(struct cpu *cpu, WORD address, struct request_data *data);
+
+// delivers every queued store, the devices are up to date afterwards
+void cpu_flush_requests(struct cpu *cpu);
+
 int shift_immediate(struct cpu *cpu, enum shift_type shift_type, int shift_amount, WORD value);
 
 bool test_overflow(int32_t op1, int32_t op2);
 
 bool check_condition(struct cpu *cpu, WORD instruction);
 
-WORD read_word_from_memory(struct cpu *cpu, WORD address);
+// cond is the 4 bit condition field, shared by arm instructions and thumb conditional branches
+bool cpu_check_condition_code(struct cpu *cpu, int cond);
+
+void cpu_build_condition_table(void);
 
-HALF_WORD read_half_word_from_memory(struct cpu *cpu, WORD address);
+// must be called after anything but cpu_set_cpsr changes the E bit
+void cpu_select_memory_accessors(struct cpu *cpu);
 
-void write_word_to_memory(struct cpu *cpu, WORD address, WORD value);
+// every load and store goes through the memory map, pages without memory go to the request channels
+static inline WORD read_word_from_memory(struct cpu *cpu, WORD address)
+{
+    return cpu->memory_accessors->read_word(cpu, address);
+}
+
+static inline HALF_WORD read_half_word_from_memory(struct cpu *cpu, WORD address)
+{
+    return cpu->memory_accessors->read_half_word(cpu, address);
+}
+
+BYTE read_byte_from_memory(struct cpu *cpu, WORD address);
 
-void write_half_word_to_memory(struct cpu *cpu, WORD address, HALF_WORD value);
+void write_byte_to_memory(struct cpu *cpu, WORD address, BYTE value);
 
-int update_register(int r1, struct cpu *cpu);
\ No newline at end of file
+static inline void write_word_to_memory(struct cpu *cpu, WORD address, WORD value)
+{
+    cpu->memory_accessors->write_word(cpu, address, value);
+}
+
+static inline void write_half_word_to_memory(struct cpu *cpu, WORD address, HALF_WORD value)
+{
+    cpu->memory_accessors->write_half_word(cpu, address, value);
+}
\ No newline at end of file
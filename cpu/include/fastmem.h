@@ -0,0 +1,136 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "data_sizes.h"
+#include "memory_map.h"
+
+enum fastmem_sizes
+{
+    FASTMEM_WINDOW_BITS = 32, // the whole guest address space, so base + address never needs a bounds check
+    FASTMEM_HOST_PAGE_SIZE = 4 * KB, // every store is aligned to this so it can be mapped on its own
+};
+
+// a 4 GB reservation where guest address a lives at window + a, built from the memory map's pages: ram and rom
+// pages are views of the same shared memory the page table points into, everything else is left protected
+struct fastmem
+{
+    BYTE *window;
+    int stores_fd;
+    BYTE *stores;
+    WORD stores_size;
+    int rom_fd;
+    bool rom_file; // rom_fd is the cartridge file itself rather than a copy, it ends at rom_size
+    BYTE *rom; // the caller's rom the rom views show
+    WORD rom_size;
+};
+
+// where a guest access faulted and where to carry on, both relative to the field itself
+struct fastmem_fixup
+{
+    int32_t fault;
+    int32_t recover;
+};
+
+// NULL when the host cannot reserve the window, the memory map then keeps its calloc'd stores
+struct fastmem *fastmem_create(WORD stores_size);
+
+void fastmem_destroy(struct fastmem *fastmem);
+
+// fd is the file rom is mapped from, the window maps it too, -1 makes the window map a copy of rom instead
+bool fastmem_set_rom(struct fastmem *fastmem, BYTE *rom, WORD size, int fd);
+
+// rebuilds the window for memory map pages first to last, called whenever the page table changes
+void fastmem_update(struct fastmem *fastmem, struct memory_map *map, WORD first, WORD last);
+
+// a protected page faults into the handler, which jumps to 3 where the access reports it did not happen
+#define FASTMEM_FIXUP \
+    "2:\n" \
+    ".pushsection .text.fastmem_recover, \"ax\"\n" \
+    "3: movl $1, %[fault]\n" \
+    "jmp 2b\n" \
+    ".popsection\n" \
+    ".pushsection fastmem_fixups, \"a\"\n" \
+    ".balign 4\n" \
+    ".long 1b - ., 3b - .\n" \
+    ".popsection\n"
+
+// palette, oam and io never get a view in the window, checking first saves them a fault and a fixup search
+static inline bool fastmem_reaches(WORD address)
+{
+    switch ((address >> REGION_SHIFT) & 0xF)
+    {
+    case REGION_IO:
+    case REGION_PALETTE:
+    case REGION_OAM:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// the loads and stores return false for mmio, the caller then takes the page table path
+static inline bool fastmem_load_32(struct fastmem *fastmem, WORD address, WORD *value)
+{
+    int fault = 0;
+    WORD loaded;
+    __asm__ volatile("1: movl (%[host]), %[loaded]\n" FASTMEM_FIXUP
+                     : [loaded] "=r"(loaded), [fault] "+r"(fault)
+                     : [host] "r"(fastmem->window + address)
+                     : "memory");
+    *value = loaded;
+    return fault == 0;
+}
+
+static inline bool fastmem_load_16(struct fastmem *fastmem, WORD address, HALF_WORD *value)
+{
+    int fault = 0;
+    WORD loaded;
+    __asm__ volatile("1: movzwl (%[host]), %[loaded]\n" FASTMEM_FIXUP
+                     : [loaded] "=r"(loaded), [fault] "+r"(fault)
+                     : [host] "r"(fastmem->window + address)
+                     : "memory");
+    *value = loaded;
+    return fault == 0;
+}
+
+static inline bool fastmem_load_8(struct fastmem *fastmem, WORD address, BYTE *value)
+{
+    int fault = 0;
+    WORD loaded;
+    __asm__ volatile("1: movzbl (%[host]), %[loaded]\n" FASTMEM_FIXUP
+                     : [loaded] "=r"(loaded), [fault] "+r"(fault)
+                     : [host] "r"(fastmem->window + address)
+                     : "memory");
+    *value = loaded;
+    return fault == 0;
+}
+
+static inline bool fastmem_store_32(struct fastmem *fastmem, WORD address, WORD value)
+{
+    int fault = 0;
+    __asm__ volatile("1: movl %[value], (%[host])\n" FASTMEM_FIXUP
+                     : [fault] "+r"(fault)
+                     : [host] "r"(fastmem->window + address), [value] "r"(value)
+                     : "memory");
+    return fault == 0;
+}
+
+static inline bool fastmem_store_16(struct fastmem *fastmem, WORD address, HALF_WORD value)
+{
+    int fault = 0;
+    __asm__ volatile("1: movw %w[value], (%[host])\n" FASTMEM_FIXUP
+                     : [fault] "+r"(fault)
+                     : [host] "r"(fastmem->window + address), [value] "r"((WORD)value)
+                     : "memory");
+    return fault == 0;
+}
+
+static inline bool fastmem_store_8(struct fastmem *fastmem, WORD address, BYTE value)
+{
+    int fault = 0;
+    __asm__ volatile("1: movb %b[value], (%[host])\n" FASTMEM_FIXUP
+                     : [fault] "+r"(fault)
+                     : [host] "r"(fastmem->window + address), [value] "q"((WORD)value)
+                     : "memory");
+    return fault == 0;
+}
@@ -25,9 +25,9 @@ enum arm_instruction_set_opcodes
     MULTIPLY_OPCODE = 0b000 << 25 | 0b1001 << 4,
     PSR_TRANSFER_OPCODE = 0b00 << 26 | 0b10 << 23 | 0b0 << 20,
     SINGLE_DATA_TRANSFER_OPCODE = 0b01 << 26,
-    HDS_DATA_TRANSFER_OPCODE = 0b000 << 25 | 0b1 << 22,
+    HDS_DATA_TRANSFER_OPCODE = 0b000 << 25 | 0b1 << 7 | 0b1 << 4,
     BLOCK_DATA_TRANSFER_OPCODE = 0b100 << 25,
-    SINGLE_DATA_SWAP_OPCODE = 0b00010 << 23,
+    SINGLE_DATA_SWAP_OPCODE = 0b00010 << 23 | 0b00 << 20 | 0b1001 << 4,
 };
 
 enum arm_instruction_set_opcode_masks
@@ -40,9 +40,9 @@ enum arm_instruction_set_opcode_masks
     MULTIPLY_OPCODE_MASK = 0b111 << 25 | 0b1111 << 4,
     PSR_TRANSFER_OPCODE_MASK = 0b11 << 26 | 0b11 << 23 | 0b1 << 20,
     SINGLE_DATA_TRANSFER_OPCODE_MASK = 0b11 << 26,
-    HDS_DATA_TRANSFER_OPCODE_MASK = 0b111 << 25 | 0b1 << 22,
+    HDS_DATA_TRANSFER_OPCODE_MASK = 0b111 << 25 | 0b1 << 7 | 0b1 << 4,
     BLOCK_DATA_TRANSFER_OPCODE_MASK = 0b111 << 25,
-    SINGLE_DATA_SWAP_OPCODE_MASK = 0b11111 << 23,
+    SINGLE_DATA_SWAP_OPCODE_MASK = 0b11111 << 23 | 0b11 << 20 | 0b1111 << 4,
 };
 
 enum thumb_instruction_set
@@ -66,6 +66,7 @@ enum thumb_instruction_set
     THUMB_MOV_CMP_ADD_SUB_IMM,
     THUMB_ADD_SUB,
     THUMB_MOVE_SHIFTED_REGISTER,
+    THUMB_UNDEFINED,
 };
 
 enum thumb_instruction_set_opcode
@@ -81,7 +82,7 @@ enum thumb_instruction_set_opcode
     THUMB_SP_RELATIVE_LOAD_STORE_OPCODE = 0b1001 << 12,
     THUMB_LOAD_ADDRESS_OPCODE = 0b1010 << 12,
     THUMB_LOAD_STORE_WITH_OFFSET_OPCODE = 0b011 << 13,
-    THUMB_LOAD_STORE_WITH_REG_OFFSET_OPCODE = 0b0101 << 12 << 0b0 << 9,
+    THUMB_LOAD_STORE_WITH_REG_OFFSET_OPCODE = 0b0101 << 12 | 0b0 << 9,
     THUMB_LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD_OPCODE = 0b0101 << 12 | 0b1 << 9,
     THUMB_PC_RELATIVE_LOAD_OPCODE = 0b01001 << 11,
     THUMB_HI_REG_OPERATION_BRANCH_EXCHANGE_OPCODE = 0b010001 << 10,
@@ -110,6 +111,6 @@ enum thumb_instruction_set_opcode_mask
     THUMB_HI_REG_OPERATION_BRANCH_EXCHANGE_OPCODE_MASK = 0b111111 << 10,
     THUMB_ALU_OPERATIONS_OPCODE_MASK = 0b111111 << 10,
     THUMB_MOV_CMP_ADD_SUB_IMM_OPCODE_MASK = 0b111 << 13,
-    THUMB_ADD_SUB_OPCODE_MASK = 0b111 << 13,
+    THUMB_ADD_SUB_OPCODE_MASK = 0b11111 << 11,
     THUMB_MOVE_SHIFTED_REGISTER_OPCODE_MASK = 0b111 << 13,
 };
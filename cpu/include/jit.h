@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "data_sizes.h"
+
+struct cpu;
+
+enum jit_sizes
+{
+    JIT_ARENA_SIZE = 16 * MB,
+    JIT_MAX_BLOCK_SIZE = 8 * KB, // worst case code for one block, checked before compiling
+    JIT_BLOCK_COUNT = 4096, // direct mapped on the block address
+    JIT_LINK_COUNT = 4096, // chain sites waiting for their target block to be compiled
+};
+
+struct jit_entry
+{
+    WORD address;
+    BYTE *code;
+    bool idle; // idle loops return to jit_run after every pass instead of chaining to themselves
+};
+
+struct jit_link
+{
+    BYTE *site; // rel32 of the jmp to patch
+    WORD target;
+};
+
+struct jit
+{
+    BYTE *arena;
+    size_t arena_used;
+    size_t code_start; // arena space after the entry trampoline
+    void (*enter)(struct cpu *cpu, BYTE *code);
+    struct jit_entry blocks[JIT_BLOCK_COUNT];
+    struct jit_link links[JIT_LINK_COUNT];
+    int link_count;
+    int32_t budget; // cycles left, every block takes its cost on entry and chains only while this is positive
+    uint64_t invalidations_seen;
+    uint64_t translated_ops;
+    uint64_t fallback_ops;
+    uint64_t compiled_blocks;
+    uint64_t chained_links;
+};
+
+struct jit *jit_create(void);
+
+void jit_destroy(struct jit *jit);
+
+void jit_flush(struct jit *jit);
+
+struct jit_entry *jit_lookup(struct cpu *cpu, WORD address);
+
+// returns the cycles run, stops early when the cpu switches to thumb or is turned off
+int32_t jit_run(struct cpu *cpu, int32_t cycles);
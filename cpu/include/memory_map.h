@@ -0,0 +1,191 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "data_sizes.h"
+
+struct fastmem;
+
+enum memory_region_sizes
+{
+    BIOS_SIZE = 16 * KB,
+    EWRAM_SIZE = 256 * KB,
+    IWRAM_SIZE = 32 * KB,
+    IO_SIZE = 1 * KB,
+    PALETTE_SIZE = 1 * KB,
+    VRAM_SIZE = 96 * KB,
+    VRAM_MIRROR_SIZE = 128 * KB, // the last 32 KB repeat the object tiles at 0x10000
+    OAM_SIZE = 1 * KB,
+    ROM_MAX_SIZE = 32 * MB,
+    SRAM_SIZE = 64 * KB,
+};
+
+enum memory_regions
+{
+    REGION_BIOS = 0x0,
+    REGION_EWRAM = 0x2,
+    REGION_IWRAM = 0x3,
+    REGION_IO = 0x4,
+    REGION_PALETTE = 0x5,
+    REGION_VRAM = 0x6,
+    REGION_OAM = 0x7,
+    REGION_ROM_WAIT_STATE_1 = 0x8,
+    REGION_ROM_WAIT_STATE_3_END = 0xD,
+    REGION_SRAM = 0xE,
+    REGION_SRAM_MIRROR = 0xF,
+    REGION_SHIFT = 24,
+};
+
+enum memory_pages
+{
+    MEMORY_PAGE_SHIFT = 14,
+    MEMORY_PAGE_SIZE = 1 << MEMORY_PAGE_SHIFT,
+    MEMORY_ADDRESS_MASK = 0x0FFFFFFF, // the top 4 address bits are not decoded
+    MEMORY_PAGE_COUNT = (MEMORY_ADDRESS_MASK + 1) >> MEMORY_PAGE_SHIFT,
+    MEMORY_STORE_ALIGN = 4 * KB, // every store starts on a host page so fastmem can map it on its own
+};
+
+// stores to the display memory are tracked at these granules so a renderer only redecodes what changed
+enum memory_dirty_sizes
+{
+    PALETTE_DIRTY_SHIFT = 5, // one 16 colour palette
+    VRAM_DIRTY_SHIFT = 8, // eight 4 bpp tiles
+    OAM_DIRTY_SHIFT = 3, // one object's attributes
+    MEMORY_DIRTY_WORDS = (VRAM_SIZE >> VRAM_DIRTY_SHIFT) / 64, // the biggest bitmap
+};
+
+// indexed by region - REGION_PALETTE
+enum memory_dirty_regions
+{
+    DIRTY_PALETTE,
+    DIRTY_VRAM,
+    DIRTY_OAM,
+    DIRTY_REGION_COUNT,
+};
+
+// a page of ram or rom is base + (address & mask), mask is smaller than the page for the 1 KB regions that
+// mirror inside it, base is NULL for unmapped pages and pages claimed by a request channel
+struct memory_page
+{
+    BYTE *base;
+    WORD mask;
+    bool read_only; // stores to rom are dropped
+};
+
+struct memory_map
+{
+    struct memory_page pages[MEMORY_PAGE_COUNT];
+    BYTE *stores; // one allocation behind every region below except the rom
+    BYTE *bios;
+    BYTE *ewram;
+    BYTE *iwram;
+    BYTE *io;
+    BYTE *palette;
+    BYTE *vram;
+    BYTE *oam;
+    BYTE *sram;
+    BYTE *rom; // owned by whoever loaded it, padded to a whole number of pages
+    WORD rom_size;
+    struct fastmem *fastmem; // NULL when LibCpu is built without fastmem or the window could not be reserved
+    uint64_t dirty[DIRTY_REGION_COUNT][MEMORY_DIRTY_WORDS]; // a bit per granule stored to since it was cleared
+};
+
+void memory_map_init(struct memory_map *map);
+
+void memory_map_free(struct memory_map *map);
+
+// fd is the file rom is mapped from so fastmem can map it as well, -1 when rom only lives in memory
+void memory_map_set_rom(struct memory_map *map, BYTE *rom, WORD size, int fd);
+
+// mmio pages send every access through the request channels, clearing it puts the region's memory back
+void memory_map_set_mmio(struct memory_map *map, WORD address, WORD size, bool mmio);
+
+// the region's own memory behind an address even when a request channel claimed its page, NULL when there is
+// none or write is set and the page is read only
+BYTE *memory_map_backing_pointer(struct memory_map *map, WORD address, bool write);
+
+// marks every granule of the display memory that address to address + size touches, anything else is ignored
+void memory_map_mark_dirty_range(struct memory_map *map, WORD address, WORD size);
+
+// true when a store reached any granule of address to address + size since it was last cleared, starts out true
+bool memory_map_is_dirty(struct memory_map *map, WORD address, WORD size);
+
+void memory_map_clear_dirty(struct memory_map *map, WORD address, WORD size);
+
+// the bitmap and bit of the granule holding a display memory address, false for every other region
+static inline bool memory_map_dirty_bit(WORD address, int *region, WORD *bit)
+{
+    switch ((address >> REGION_SHIFT) & 0xF)
+    {
+    case REGION_PALETTE:
+        *region = DIRTY_PALETTE;
+        *bit = (address & (PALETTE_SIZE - 1)) >> PALETTE_DIRTY_SHIFT;
+        return true;
+    case REGION_VRAM:
+    {
+        WORD offset = address & (VRAM_MIRROR_SIZE - 1);
+        if (offset >= VRAM_SIZE)
+        {
+            offset -= VRAM_MIRROR_SIZE - VRAM_SIZE;
+        }
+        *region = DIRTY_VRAM;
+        *bit = offset >> VRAM_DIRTY_SHIFT;
+        return true;
+    }
+    case REGION_OAM:
+        *region = DIRTY_OAM;
+        *bit = (address & (OAM_SIZE - 1)) >> OAM_DIRTY_SHIFT;
+        return true;
+    default:
+        return false;
+    }
+}
+
+// called on every store, a single aligned access never spans two granules, an unaligned one may
+static inline void memory_map_mark_dirty(struct memory_map *map, WORD address, WORD size)
+{
+    int region;
+    WORD bit;
+    if (size > sizeof(WORD) || (address & (size - 1)) != 0)
+    {
+        memory_map_mark_dirty_range(map, address, size);
+    }
+    else if (memory_map_dirty_bit(address, &region, &bit))
+    {
+        map->dirty[region][bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+}
+
+static inline struct memory_page *memory_map_page(struct memory_map *map, WORD address)
+{
+    return &map->pages[(address & MEMORY_ADDRESS_MASK) >> MEMORY_PAGE_SHIFT];
+}
+
+// NULL when the access has to go through the request channels
+static inline BYTE *memory_map_pointer(struct memory_map *map, WORD address)
+{
+    struct memory_page *page = memory_map_page(map, address);
+    return page->base == NULL ? NULL : page->base + (address & page->mask);
+}
+
+// NULL for read only pages as well, the store then goes to the request channels which drop it
+static inline BYTE *memory_map_write_pointer(struct memory_map *map, WORD address)
+{
+    struct memory_page *page = memory_map_page(map, address);
+    return page->base == NULL || page->read_only ? NULL : page->base + (address & page->mask);
+}
+
+// like memory_map_pointer, length is how many bytes follow contiguously in host memory
+static inline BYTE *memory_map_span(struct memory_map *map, WORD address, WORD *length)
+{
+    struct memory_page *page = memory_map_page(map, address);
+    if (page->base == NULL)
+    {
+        *length = 0;
+        return NULL;
+    }
+    WORD offset = address & page->mask;
+    WORD page_left = MEMORY_PAGE_SIZE - (address & (MEMORY_PAGE_SIZE - 1));
+    WORD mirror_left = page->mask + 1 - offset;
+    *length = page_left < mirror_left ? page_left : mirror_left;
+    return page->base + offset;
+}
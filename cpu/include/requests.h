@@ -1,3 +1,4 @@
+#pragma once
 #include "data_sizes.h"
 #include <stdint.h>
 struct request_data
@@ -13,6 +14,14 @@ struct request_data
     } data;
 };
 
+enum request_channel_sizes
+{
+    MMIO_PAGE_SHIFT = 12,
+    MMIO_PAGE_COUNT = 1 << (28 - MMIO_PAGE_SHIFT), // over the 28 decoded address bits
+    MMIO_NO_CHANNEL = 0xFF,
+    MMIO_MAX_CHANNELS = MMIO_NO_CHANNEL, // channel indexes have to fit a mmio page entry
+};
+
 struct request_channel
 {
     const char* name;
@@ -20,4 +29,10 @@ struct request_channel
     int memory_address;
     int memory_range;
     void (*push_to_channel)(struct request_data*);
+    // 0 delivers every store as it happens, otherwise up to this many stores are held back and delivered together
+    // before the next scheduler event, before any read of the channel and when the queue fills
+    int queue_length;
+    void (*flush_channel)(struct request_data*, int count); // optional, push_to_channel gets them one by one without it
+    struct request_data *queue; // owned by the cpu
+    int queued;
 };
\ No newline at end of file
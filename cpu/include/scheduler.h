@@ -0,0 +1,60 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "data_sizes.h"
+
+struct cpu;
+
+enum scheduler_sizes
+{
+    SCHEDULER_MAX_EVENTS = 64,
+};
+
+// used to cancel or reschedule a pending event
+enum scheduler_event_type
+{
+    EVENT_HBLANK,
+    EVENT_VBLANK,
+    EVENT_TIMER_0,
+    EVENT_TIMER_1,
+    EVENT_TIMER_2,
+    EVENT_TIMER_3,
+    EVENT_DMA_0,
+    EVENT_DMA_1,
+    EVENT_DMA_2,
+    EVENT_DMA_3,
+    EVENT_IRQ,
+    EVENT_USER,
+};
+
+// when is the cycle the event was due at, the cpu may have run a few cycles past it
+typedef void (*scheduler_callback)(struct cpu *cpu, void *data, uint64_t when);
+
+struct scheduler_event
+{
+    uint64_t when;
+    enum scheduler_event_type type;
+    scheduler_callback callback;
+    void *data;
+};
+
+// binary min heap on when, events[0] is always the next one due
+struct scheduler
+{
+    struct scheduler_event events[SCHEDULER_MAX_EVENTS];
+    int event_count;
+};
+
+void scheduler_init(struct scheduler *scheduler);
+
+bool scheduler_add(struct scheduler *scheduler, uint64_t when, enum scheduler_event_type type, scheduler_callback callback, void *data);
+
+void scheduler_cancel(struct scheduler *scheduler, enum scheduler_event_type type);
+
+// runs every event due at or before cpu->cycles, in order, including ones the callbacks add
+void scheduler_run_due(struct cpu *cpu);
+
+static inline uint64_t scheduler_next_deadline(struct scheduler *scheduler)
+{
+    return scheduler->event_count > 0 ? scheduler->events[0].when : UINT64_MAX;
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include "cpu.h"
 
+struct cpu;
 
 enum gba_syscall_number
 {
@@ -51,8 +52,17 @@ enum gba_syscall_number
     SOUNDD_RIVER_VSYNC_OFF = 0x28,
     SOUNDD_RIVER_VSYNC_ON = 0x29,
     SOUND_GET_JUMP_LIST = 0x2A,
+    GBA_SYSCALL_COUNT,
 };
 
+enum gba_bios_constants
+{
+    GBA_BIOS_CHECKSUM = 0xBAAE187F,
+};
+
+// native version of a bios call, takes its arguments from and returns them in the registers
+typedef void (*gba_syscall)(struct cpu *cpu);
+
 enum arm_syscall_number
 {
     RESTART_SYSCALL = 0x0,
@@ -63,3 +73,50 @@ enum arm_syscall_number
     OPEN,
     CLOSE,
 };
+
+// runs the bios call natively when hle is on, there is a native version and the call is not forced to the
+// bios, returns false when the swi should vector into the bios instead
+bool cpu_hle_syscall(struct cpu *cpu, int number);
+
+// force one call back to the interpreted bios, for debugging a native version against it
+void cpu_set_syscall_lle(struct cpu *cpu, enum gba_syscall_number number, bool lle);
+
+void gba_div(struct cpu *cpu);
+
+void gba_div_arm(struct cpu *cpu);
+
+void gba_sqrt(struct cpu *cpu);
+
+void gba_arctan(struct cpu *cpu);
+
+void gba_arctan2(struct cpu *cpu);
+
+void gba_cpu_set(struct cpu *cpu);
+
+void gba_cpu_fast_set(struct cpu *cpu);
+
+void gba_get_bios_checksum(struct cpu *cpu);
+
+void gba_bg_affine_set(struct cpu *cpu);
+
+void gba_obj_affine_set(struct cpu *cpu);
+
+// the decompression calls stream straight into memory, the 16 bit variants only store halfwords so they
+// can target vram
+void gba_bit_unpack(struct cpu *cpu);
+
+void gba_lz77_write_8_bit(struct cpu *cpu);
+
+void gba_lz77_write_16_bit(struct cpu *cpu);
+
+void gba_huffman(struct cpu *cpu);
+
+void gba_rl_write_8_bit(struct cpu *cpu);
+
+void gba_rl_write_16_bit(struct cpu *cpu);
+
+void gba_diff_8_bit_write_8_bit(struct cpu *cpu);
+
+void gba_diff_8_bit_write_16_bit(struct cpu *cpu);
+
+void gba_diff_16_bit(struct cpu *cpu);
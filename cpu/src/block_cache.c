@@ -0,0 +1,450 @@
+#include <string.h>
+#include "cpu.h"
+
+void block_cache_init(struct block_cache *cache)
+{
+    cache->blocks = calloc(BLOCK_CACHE_SIZE, sizeof(struct block));
+    block_cache_flush(cache);
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->invalidations = 0;
+    cache->idle_detection = true;
+    cache->idle_override_count = 0;
+    cache->idle_skips = 0;
+    cache->idle_cycles_skipped = 0;
+}
+
+void block_cache_free(struct block_cache *cache)
+{
+    free(cache->blocks);
+    cache->blocks = NULL;
+}
+
+void block_cache_flush(struct block_cache *cache)
+{
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++)
+    {
+        cache->blocks[i].valid = false;
+    }
+    for (int i = 0; i < BLOCK_CODE_PAGE_COUNT / 64; i++)
+    {
+        cache->code_pages[i] = 0;
+    }
+    // anything built from the old blocks, like translated code, has to go too
+    cache->invalidations++;
+}
+
+static void mark_code_pages(struct block_cache *cache, WORD start, WORD end)
+{
+    for (WORD address = start; address < end; address += 1 << BLOCK_CODE_PAGE_SHIFT)
+    {
+        WORD page = (address >> BLOCK_CODE_PAGE_SHIFT) & (BLOCK_CODE_PAGE_COUNT - 1);
+        cache->code_pages[page / 64] |= (uint64_t)0b1 << (page % 64);
+    }
+    WORD page = ((end - 1) >> BLOCK_CODE_PAGE_SHIFT) & (BLOCK_CODE_PAGE_COUNT - 1);
+    cache->code_pages[page / 64] |= (uint64_t)0b1 << (page % 64);
+}
+
+// instructions that may write PC or change the instruction set without being a branch
+static bool arm_op_ends_block(const struct arm_decode_entry *entry, WORD instruction)
+{
+    enum
+    {
+        L = 0b1 << 20,
+        Rd = 0b1111 << 12,
+        PC_IN_RLIST = 0b1 << PC,
+    };
+    if (!entry->increments_pc)
+    {
+        return true;
+    }
+    switch (entry->type)
+    {
+    case DATA_PROCESSING:
+        return ((instruction & Rd) >> 12) == PC;
+    case SINGLE_DATA_TRANSFER:
+        return (instruction & L) && ((instruction & Rd) >> 12) == PC;
+    case BLOCK_DATA_TRANSFER:
+        return (instruction & L) && (instruction & PC_IN_RLIST);
+    case PSR_TRANSFER:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool thumb_op_ends_block(const struct thumb_decode_entry *entry, HALF_WORD instruction)
+{
+    enum
+    {
+        POP_PC = 0b1 << 11 | 0b1 << 8,
+    };
+    // push/pop advances pc itself, so check it before increments_pc
+    switch (entry->type)
+    {
+    case THUMB_HI_REG_OPERATION_BRANCH_EXCHANGE:
+        return true;
+    case THUMB_PUSH_POP_REGISTERS:
+        return (instruction & POP_PC) == POP_PC;
+    default:
+        return !entry->increments_pc;
+    }
+}
+
+// empty on purpose, a loop only goes in once it has been checked against the game, the entry below just keeps
+// the array from being empty
+static const struct idle_loop_override idle_loop_overrides[] = {
+    {.game_code = "", .address = 0},
+};
+
+enum idle_effects
+{
+    FLAGS_READ_WRITE = 0b1 << 16, // NZCV take part in the register dependencies like a 17th register
+};
+
+// registers read and written by an op that may sit in an idle loop, false when it has any other effect
+static bool arm_op_idle_effects(const struct arm_decode_entry *entry, WORD instruction, uint32_t *reads, uint32_t *writes)
+{
+    enum
+    {
+        I = 0b1 << 25,
+        P = 0b1 << 24,
+        LINK = 0b1 << 24,
+        HDS_I = 0b1 << 22,
+        W = 0b1 << 21,
+        S = 0b1 << 20,
+        L = 0b1 << 20,
+        R = 0b1 << 4,
+    };
+    int rn = (instruction >> 16) & 0xF;
+    int rd = (instruction >> 12) & 0xF;
+    int rs = (instruction >> 8) & 0xF;
+    int rm = instruction & 0xF;
+    int opcode = (instruction >> 21) & 0xF;
+    *reads = ((instruction >> 28) & 0xF) != 0xE ? FLAGS_READ_WRITE : 0;
+    *writes = 0;
+    switch (entry->type)
+    {
+    case BRANCH:
+        return (instruction & LINK) == 0;
+    case DATA_PROCESSING:
+        if (rd == PC || rn == PC || (!(instruction & I) && rm == PC))
+        {
+            return false;
+        }
+        if (opcode != 0xD && opcode != 0xF)
+        {
+            *reads |= 0b1 << rn;
+        }
+        if (!(instruction & I))
+        {
+            *reads |= 0b1 << rm;
+            if (instruction & R)
+            {
+                *reads |= 0b1 << rs;
+            }
+        }
+        if (opcode >= 0x5 && opcode <= 0x7)
+        {
+            *reads |= FLAGS_READ_WRITE;
+        }
+        if (opcode < 0x8 || opcode > 0xB)
+        {
+            *writes |= 0b1 << rd;
+        }
+        if (instruction & S)
+        {
+            *writes |= FLAGS_READ_WRITE;
+        }
+        return true;
+    case SINGLE_DATA_TRANSFER:
+        // loads with no writeback, the I bit selects a register offset here
+        if (!(instruction & L) || !(instruction & P) || (instruction & W) || rd == PC)
+        {
+            return false;
+        }
+        *reads |= 0b1 << rn | ((instruction & I) ? 0b1 << rm : 0);
+        *writes |= 0b1 << rd;
+        return true;
+    case HDS_DATA_TRANSFER:
+        if (!(instruction & L) || !(instruction & P) || (instruction & W) || rd == PC)
+        {
+            return false;
+        }
+        *reads |= 0b1 << rn | ((instruction & HDS_I) ? 0 : 0b1 << rm);
+        *writes |= 0b1 << rd;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool thumb_op_idle_effects(const struct thumb_decode_entry *entry, HALF_WORD instruction, uint32_t *reads, uint32_t *writes)
+{
+    enum
+    {
+        L = 0b1 << 11,
+    };
+    int rd = instruction & 0b111;
+    int rs = (instruction >> 3) & 0b111;
+    int high_rd = (instruction >> 8) & 0b111;
+    *reads = 0;
+    *writes = 0;
+    switch (entry->type)
+    {
+    case THUMB_CONDITIONAL_BRANCH:
+        *reads = FLAGS_READ_WRITE;
+        return true;
+    case THUMB_UNCONDITIONAL_BRANCH:
+        return true;
+    case THUMB_MOV_CMP_ADD_SUB_IMM:
+    {
+        int opcode = (instruction >> 11) & 0b11;
+        *reads = opcode == 0b00 ? 0 : 0b1 << high_rd;
+        *writes = (opcode == 0b01 ? 0 : 0b1 << high_rd) | FLAGS_READ_WRITE;
+        return true;
+    }
+    case THUMB_ALU_OPERATIONS:
+    {
+        int opcode = (instruction >> 6) & 0xF;
+        *reads = 0b1 << rs;
+        if (opcode != 0x9 && opcode != 0xF) // NEG and MVN only read Rs
+        {
+            *reads |= 0b1 << rd;
+        }
+        if (opcode == 0x5 || opcode == 0x6) // ADC and SBC
+        {
+            *reads |= FLAGS_READ_WRITE;
+        }
+        *writes = (opcode == 0x8 || opcode == 0xA || opcode == 0xB ? 0 : 0b1 << rd) | FLAGS_READ_WRITE;
+        return true;
+    }
+    case THUMB_LOAD_STORE_WITH_OFFSET:
+    case THUMB_LOAD_STORE_HALFWORD:
+        if (!(instruction & L))
+        {
+            return false;
+        }
+        *reads = 0b1 << rs;
+        *writes = 0b1 << rd;
+        return true;
+    case THUMB_PC_RELATIVE_LOAD:
+        *writes = 0b1 << high_rd;
+        return true;
+    default:
+        return false;
+    }
+}
+
+static WORD branch_target(struct block *block)
+{
+    struct block_op *last = &block->ops[block->op_count - 1];
+    if (block->thumb)
+    {
+        WORD address = block->end - sizeof(HALF_WORD);
+        if (last->execute.thumb == thumb_conditional_branch)
+        {
+            return address + 4 + ((int8_t)(last->instruction & 0xFF) << 1);
+        }
+        int32_t offset = last->instruction & 0x7FF;
+        offset = (offset << 21) >> 21;
+        return address + 4 + (offset << 1);
+    }
+    int32_t offset = (int32_t)(last->imm << 8) >> 8;
+    return block->end - sizeof(WORD) + 8 + (offset << 2);
+}
+
+static bool is_idle_override(struct block_cache *cache, WORD address)
+{
+    for (int i = 0; i < cache->idle_override_count; i++)
+    {
+        if (cache->idle_overrides[i] == address)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void compile_block(struct cpu *cpu, struct block *block, WORD address, bool thumb)
+{
+    block->address = address;
+    block->thumb = thumb;
+    block->op_count = 0;
+    block->cycles = 0;
+    bool ends = false;
+    // a loop is idle when every register it reads was either never written in it or written earlier in
+    // the same pass, so the second pass through recomputes exactly what the first one did
+    bool idle = cpu->block_cache.idle_detection;
+    uint32_t written = 0;
+    uint32_t read_before_written = 0;
+    uint32_t reads = 0;
+    uint32_t writes = 0;
+    while (!ends && block->op_count < BLOCK_MAX_OPS)
+    {
+        struct block_op *op = &block->ops[block->op_count];
+        if (thumb)
+        {
+            HALF_WORD instruction = read_half_word_from_memory(cpu, address);
+            const struct thumb_decode_entry *entry = cpu_lookup_thumb_instruction(instruction);
+            op->execute.thumb = entry->execute;
+            op->increments_pc = entry->increments_pc;
+            op->cycles = entry->cycles;
+            op->instruction = instruction;
+            op->condition = entry->type == THUMB_CONDITIONAL_BRANCH ? (instruction >> 8) & 0xF : 0xE;
+            op->rd = instruction & 0b111;
+            op->rn = (instruction >> 3) & 0b111;
+            op->rm = (instruction >> 6) & 0b111;
+            op->imm = instruction & 0xFF;
+            ends = thumb_op_ends_block(entry, instruction);
+            idle = idle && thumb_op_idle_effects(entry, instruction, &reads, &writes);
+            address += sizeof(HALF_WORD) / sizeof(BYTE);
+        }
+        else
+        {
+            WORD instruction = read_word_from_memory(cpu, address);
+            const struct arm_decode_entry *entry = cpu_lookup_arm_instruction(instruction);
+            op->execute.arm = entry->execute;
+            op->increments_pc = entry->increments_pc;
+            op->cycles = entry->cycles;
+            op->instruction = instruction;
+            op->condition = (instruction >> 28) & 0xF;
+            op->rd = (instruction >> 12) & 0xF;
+            op->rn = (instruction >> 16) & 0xF;
+            op->rm = instruction & 0xF;
+            op->imm = entry->type == BRANCH ? instruction & 0xFFFFFF : instruction & 0xFFF;
+            ends = arm_op_ends_block(entry, instruction);
+            idle = idle && arm_op_idle_effects(entry, instruction, &reads, &writes);
+            address += sizeof(WORD) / sizeof(BYTE);
+        }
+        read_before_written |= reads & ~written;
+        written |= writes;
+        block->cycles += op->cycles;
+        block->op_count++;
+    }
+    block->end = address;
+    block->valid = true;
+    struct block_op *last = &block->ops[block->op_count - 1];
+    bool branches = thumb ? (last->execute.thumb == thumb_conditional_branch || last->execute.thumb == thumb_unconditional_branch)
+                          : last->execute.arm == arm_branch;
+    idle = idle && block->op_count <= BLOCK_IDLE_MAX_OPS && !(read_before_written & written);
+    block->idle = branches && branch_target(block) == block->address && (idle || is_idle_override(&cpu->block_cache, block->address));
+    mark_code_pages(&cpu->block_cache, block->address, block->end);
+}
+
+struct block *block_cache_lookup(struct cpu *cpu, WORD address, bool thumb)
+{
+    struct block_cache *cache = &cpu->block_cache;
+    struct block *block = &cache->blocks[(address >> 1) & (BLOCK_CACHE_SIZE - 1)];
+    if (block->valid && block->address == address && block->thumb == thumb)
+    {
+        cache->hits++;
+        return block;
+    }
+    cache->misses++;
+    compile_block(cpu, block, address, thumb);
+    return block;
+}
+
+int block_cache_execute(struct cpu *cpu, struct block *block)
+{
+    WORD pc = block->address;
+    int cycles = 0;
+    if (block->thumb)
+    {
+        for (int i = 0; i < block->op_count; i++)
+        {
+            struct block_op *op = &block->ops[i];
+            op->execute.thumb(cpu, op->instruction);
+            cycles += op->cycles;
+            if (op->increments_pc)
+            {
+                cpu->registers[PC] += sizeof(HALF_WORD) / sizeof(BYTE);
+            }
+            pc += sizeof(HALF_WORD) / sizeof(BYTE);
+            // leave on taken branches, state changes and stores into the block itself
+            if (cpu->registers[PC] != pc || !(cpu->registers[CPSR] & T_MASK) || !block->valid)
+            {
+                return cycles;
+            }
+        }
+    }
+    else
+    {
+        for (int i = 0; i < block->op_count; i++)
+        {
+            struct block_op *op = &block->ops[i];
+            if (check_condition(cpu, op->instruction))
+            {
+                op->execute.arm(cpu, op->instruction);
+                cycles += op->cycles;
+                if (op->increments_pc)
+                {
+                    cpu->registers[PC] += sizeof(WORD) / sizeof(BYTE);
+                }
+            }
+            else
+            {
+                cycles++;
+                cpu->registers[PC] += sizeof(WORD) / sizeof(BYTE);
+            }
+            pc += sizeof(WORD) / sizeof(BYTE);
+            if (cpu->registers[PC] != pc || (cpu->registers[CPSR] & T_MASK) || !block->valid)
+            {
+                return cycles;
+            }
+        }
+    }
+    return cycles;
+}
+
+void block_cache_invalidate(struct block_cache *cache, WORD address, WORD size)
+{
+    WORD end = address + size;
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++)
+    {
+        struct block *block = &cache->blocks[i];
+        if (block->valid && block->address < end && address < block->end)
+        {
+            block->valid = false;
+            cache->invalidations++;
+        }
+    }
+}
+
+bool block_cache_add_idle_override(struct block_cache *cache, WORD address)
+{
+    if (cache->idle_override_count == BLOCK_IDLE_OVERRIDE_COUNT)
+    {
+        printf("Error: too many idle loop overrides, ignoring 0x%08x\n", address);
+        return false;
+    }
+    cache->idle_overrides[cache->idle_override_count++] = address;
+    // blocks already compiled at the address need to pick the override up
+    block_cache_flush(cache);
+    return true;
+}
+
+void block_cache_clear_idle_overrides(struct block_cache *cache)
+{
+    if (cache->idle_override_count == 0)
+    {
+        return;
+    }
+    cache->idle_override_count = 0;
+    block_cache_flush(cache);
+}
+
+int block_cache_load_idle_overrides(struct block_cache *cache, const char *game_code)
+{
+    int added = 0;
+    for (int i = 0; i < sizeof(idle_loop_overrides) / sizeof(idle_loop_overrides[0]); i++)
+    {
+        const struct idle_loop_override *override = &idle_loop_overrides[i];
+        if (override->address != 0 && strncmp(override->game_code, game_code, sizeof(override->game_code)) == 0)
+        {
+            added += block_cache_add_idle_override(cache, override->address);
+        }
+    }
+    return added;
+}
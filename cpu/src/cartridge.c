@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "../include/cartridge.h"
+#include "../include/memory_map.h"
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define CARTRIDGE_MMAP
+#endif
+
+// the memory map hands out whole pages, the bytes past the end of the file read as zero
+static size_t reserved_size(WORD size)
+{
+    return ((size_t)size + MEMORY_PAGE_SIZE - 1) & ~(size_t)(MEMORY_PAGE_SIZE - 1);
+}
+
+#ifdef CARTRIDGE_MMAP
+static bool map_file(struct cartridge *cartridge, int fd, WORD size)
+{
+    size_t reserved = reserved_size(size);
+    // zero pages first, then the file over the front of them
+    BYTE *data = mmap(NULL, reserved, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    if (mmap(data, size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(data, reserved);
+        return false;
+    }
+    // start reading ahead without making the load wait for all 32 MB
+    madvise(data, size, MADV_WILLNEED);
+    *cartridge = (struct cartridge){.data = data, .size = size, .reserved = reserved, .mapped = true, .fd = dup(fd)};
+    return true;
+}
+#endif
+
+static bool read_file(struct cartridge *cartridge, FILE *f, WORD size)
+{
+    size_t reserved = reserved_size(size);
+    BYTE *data = calloc(reserved, sizeof(BYTE));
+    if (data == NULL)
+    {
+        printf("Error: failed to allocate 0x%zx bytes for the rom\n", reserved);
+        return false;
+    }
+    if (fread(data, 1, size, f) != size)
+    {
+        printf("Error: failed to read the rom, errno: %d\n", errno);
+        free(data);
+        return false;
+    }
+    *cartridge = (struct cartridge){.data = data, .size = size, .reserved = reserved, .mapped = false, .fd = -1};
+    return true;
+}
+
+bool cartridge_load(struct cartridge *cartridge, const char *path)
+{
+    *cartridge = (struct cartridge){.data = NULL, .fd = -1};
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        printf("Error: failed to open rom %s, errno: %d\n", path, errno);
+        return false;
+    }
+    long length = -1;
+    if (fseek(f, 0, SEEK_END) == 0)
+    {
+        length = ftell(f);
+        fseek(f, 0, SEEK_SET);
+    }
+    if (length <= 0)
+    {
+        printf("Error: rom %s is empty\n", path);
+        fclose(f);
+        return false;
+    }
+    WORD size = length;
+    if (length > ROM_MAX_SIZE)
+    {
+        printf("Error: rom is 0x%lx bytes, only the first 0x%x are loaded\n", length, ROM_MAX_SIZE);
+        size = ROM_MAX_SIZE;
+    }
+    bool loaded = false;
+#ifdef CARTRIDGE_MMAP
+    loaded = map_file(cartridge, fileno(f), size);
+#endif
+    if (!loaded)
+    {
+        loaded = read_file(cartridge, f, size);
+    }
+    fclose(f);
+    return loaded;
+}
+
+void cartridge_unload(struct cartridge *cartridge)
+{
+    if (cartridge->data == NULL)
+    {
+        return;
+    }
+#ifdef CARTRIDGE_MMAP
+    if (cartridge->mapped)
+    {
+        munmap(cartridge->data, cartridge->reserved);
+    }
+    if (cartridge->fd >= 0)
+    {
+        close(cartridge->fd);
+    }
+#endif
+    if (!cartridge->mapped)
+    {
+        free(cartridge->data);
+    }
+    *cartridge = (struct cartridge){.data = NULL, .fd = -1};
+}
@@ -1,4 +1,126 @@
+#include <string.h>
 #include "cpu.h"
+#ifdef CPU_JIT
+#include "jit.h"
+#endif
+#ifdef CPU_FASTMEM
+#include "fastmem.h"
+#endif
+
+static const char *const arm_instruction_names[] = {
+    [BRANCH] = "branch",
+    [BRANCH_AND_EXCHANGE] = "branch & exchange",
+    [SOFTWARE_INTERRUPT] = "software interrupt",
+    [UNDEFINED] = "undefined",
+    [DATA_PROCESSING] = "data processing",
+    [MULTIPLY] = "multiply",
+    [PSR_TRANSFER] = "psr transfer",
+    [SINGLE_DATA_TRANSFER] = "single data transfer",
+    [HDS_DATA_TRANSFER] = "hds data transfer",
+    [BLOCK_DATA_TRANSFER] = "block data transfer",
+    [SINGLE_DATA_SWAP] = "single data swap",
+};
+
+// branches, software interrupts and undefined instructions set PC themselves
+// cycles are sequential + non sequential + internal cycles of the usual case, without wait states
+static const struct arm_decode_entry arm_decode_entries[] = {
+    [BRANCH] = {.execute = arm_branch, .type = BRANCH, .increments_pc = false, .cycles = 3},
+    [BRANCH_AND_EXCHANGE] = {.execute = arm_branch_and_exchange, .type = BRANCH_AND_EXCHANGE, .increments_pc = false, .cycles = 3},
+    [SOFTWARE_INTERRUPT] = {.execute = arm_software_interrupt, .type = SOFTWARE_INTERRUPT, .increments_pc = false, .cycles = 3},
+    [UNDEFINED] = {.execute = arm_undefined_instruction, .type = UNDEFINED, .increments_pc = false, .cycles = 3},
+    [DATA_PROCESSING] = {.execute = arm_data_processing, .type = DATA_PROCESSING, .increments_pc = true, .cycles = 1},
+    [MULTIPLY] = {.execute = arm_multiply, .type = MULTIPLY, .increments_pc = true, .cycles = 4},
+    [PSR_TRANSFER] = {.execute = arm_psr_transfer, .type = PSR_TRANSFER, .increments_pc = true, .cycles = 1},
+    [SINGLE_DATA_TRANSFER] = {.execute = arm_single_data_transfer, .type = SINGLE_DATA_TRANSFER, .increments_pc = true, .cycles = 3},
+    [HDS_DATA_TRANSFER] = {.execute = arm_hds_data_transfer, .type = HDS_DATA_TRANSFER, .increments_pc = true, .cycles = 3},
+    [BLOCK_DATA_TRANSFER] = {.execute = arm_block_data_transfer, .type = BLOCK_DATA_TRANSFER, .increments_pc = true, .cycles = 4},
+    [SINGLE_DATA_SWAP] = {.execute = arm_single_data_swap, .type = SINGLE_DATA_SWAP, .increments_pc = true, .cycles = 4},
+};
+
+static struct arm_decode_entry arm_decode_table[ARM_DECODE_TABLE_SIZE];
+static bool arm_decode_table_ready = false;
+
+static const char *const thumb_instruction_names[] = {
+    [THUMB_SOFTWARE_INTERRUPT] = "software interrupt",
+    [THUMB_UNCONDITIONAL_BRANCH] = "unconditional branch",
+    [THUMB_CONDITIONAL_BRANCH] = "conditional branch",
+    [THUMB_MULTIPLE_LOAD_STORE] = "multiple load store",
+    [THUMB_LONG_BRANCH_AND_LINK] = "long branch and link",
+    [THUMB_OFFSET_STACKPOINTER] = "offset stackpointer",
+    [THUMB_PUSH_POP_REGISTERS] = "push pop registers",
+    [THUMB_LOAD_STORE_HALFWORD] = "load store halfword",
+    [THUMB_SP_RELATIVE_LOAD_STORE] = "sp relative load store",
+    [THUMB_LOAD_ADDRESS] = "load address",
+    [THUMB_LOAD_STORE_WITH_OFFSET] = "load store with offset",
+    [THUMB_LOAD_STORE_WITH_REG_OFFSET] = "load store with reg offset",
+    [THUMB_LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD] = "load store sign extended byte halfword",
+    [THUMB_PC_RELATIVE_LOAD] = "pc relative load",
+    [THUMB_HI_REG_OPERATION_BRANCH_EXCHANGE] = "hi reg operation branch exchange",
+    [THUMB_ALU_OPERATIONS] = "alu operations",
+    [THUMB_MOV_CMP_ADD_SUB_IMM] = "mov cmp add sub imm",
+    [THUMB_ADD_SUB] = "add sub",
+    [THUMB_MOVE_SHIFTED_REGISTER] = "move shifted register",
+    [THUMB_UNDEFINED] = "undefined",
+};
+
+// checked in order, so more specific encodings come before the ones they overlap with
+static const struct
+{
+    HALF_WORD opcode;
+    HALF_WORD mask;
+} thumb_opcodes[] = {
+    [THUMB_SOFTWARE_INTERRUPT] = {THUMB_SOFTWARE_INTERRUPT_OPCODE, THUMB_SOFTWARE_INTERRUPT_OPCODE_MASK},
+    [THUMB_UNCONDITIONAL_BRANCH] = {THUMB_UNCONDITIONAL_BRANCH_OPCODE, THUMB_UNCONDITIONAL_BRANCH_OPCODE_MASK},
+    [THUMB_CONDITIONAL_BRANCH] = {THUMB_CONDITIONAL_BRANCH_OPCODE, THUMB_CONDITIONAL_BRANCH_OPCODE_MASK},
+    [THUMB_MULTIPLE_LOAD_STORE] = {THUMB_MULTIPLE_LOAD_STORE_OPCODE, THUMB_MULTIPLE_LOAD_STORE_OPCODE_MASK},
+    [THUMB_LONG_BRANCH_AND_LINK] = {THUMB_LONG_BRANCH_AND_LINK_OPCODE, THUMB_LONG_BRANCH_AND_LINK_OPCODE_MASK},
+    [THUMB_OFFSET_STACKPOINTER] = {THUMB_OFFSET_STACKPOINTER_OPCODE, THUMB_OFFSET_STACKPOINTER_OPCODE_MASK},
+    [THUMB_PUSH_POP_REGISTERS] = {THUMB_PUSH_POP_REGISTERS_OPCODE, THUMB_PUSH_POP_REGISTERS_OPCODE_MASK},
+    [THUMB_LOAD_STORE_HALFWORD] = {THUMB_LOAD_STORE_HALFWORD_OPCODE, THUMB_LOAD_STORE_HALFWORD_OPCODE_MASK},
+    [THUMB_SP_RELATIVE_LOAD_STORE] = {THUMB_SP_RELATIVE_LOAD_STORE_OPCODE, THUMB_SP_RELATIVE_LOAD_STORE_OPCODE_MASK},
+    [THUMB_LOAD_ADDRESS] = {THUMB_LOAD_ADDRESS_OPCODE, THUMB_LOAD_ADDRESS_OPCODE_MASK},
+    [THUMB_LOAD_STORE_WITH_OFFSET] = {THUMB_LOAD_STORE_WITH_OFFSET_OPCODE, THUMB_LOAD_STORE_WITH_OFFSET_OPCODE_MASK},
+    [THUMB_LOAD_STORE_WITH_REG_OFFSET] = {THUMB_LOAD_STORE_WITH_REG_OFFSET_OPCODE, THUMB_LOAD_STORE_WITH_REG_OFFSET_OPCODE_MASK},
+    [THUMB_LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD] = {THUMB_LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD_OPCODE, THUMB_LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD_OPCODE_MASK},
+    [THUMB_PC_RELATIVE_LOAD] = {THUMB_PC_RELATIVE_LOAD_OPCODE, THUMB_PC_RELATIVE_LOAD_OPCODE_MASK},
+    [THUMB_HI_REG_OPERATION_BRANCH_EXCHANGE] = {THUMB_HI_REG_OPERATION_BRANCH_EXCHANGE_OPCODE, THUMB_HI_REG_OPERATION_BRANCH_EXCHANGE_OPCODE_MASK},
+    [THUMB_ALU_OPERATIONS] = {THUMB_ALU_OPERATIONS_OPCODE, THUMB_ALU_OPERATIONS_OPCODE_MASK},
+    [THUMB_MOV_CMP_ADD_SUB_IMM] = {THUMB_MOV_CMP_ADD_SUB_IMM_OPCODE, THUMB_MOV_CMP_ADD_SUB_IMM_OPCODE_MASK},
+    [THUMB_ADD_SUB] = {THUMB_ADD_SUB_OPCODE, THUMB_ADD_SUB_OPCODE_MASK},
+    [THUMB_MOVE_SHIFTED_REGISTER] = {THUMB_MOVE_SHIFTED_REGISTER_OPCODE, THUMB_MOVE_SHIFTED_REGISTER_OPCODE_MASK},
+};
+
+// branches and software interrupts set PC themselves
+// cycles are sequential + non sequential + internal cycles of the usual case, without wait states
+static const struct thumb_decode_entry thumb_decode_entries[] = {
+    [THUMB_SOFTWARE_INTERRUPT] = {.execute = thumb_software_interrupt, .type = THUMB_SOFTWARE_INTERRUPT, .increments_pc = false, .cycles = 3},
+    [THUMB_UNCONDITIONAL_BRANCH] = {.execute = thumb_unconditional_branch, .type = THUMB_UNCONDITIONAL_BRANCH, .increments_pc = false, .cycles = 3},
+    [THUMB_CONDITIONAL_BRANCH] = {.execute = thumb_conditional_branch, .type = THUMB_CONDITIONAL_BRANCH, .increments_pc = false, .cycles = 3},
+    [THUMB_MULTIPLE_LOAD_STORE] = {.execute = thumb_multiple_load_store, .type = THUMB_MULTIPLE_LOAD_STORE, .increments_pc = true, .cycles = 4},
+    [THUMB_LONG_BRANCH_AND_LINK] = {.execute = thumb_long_branch_and_link, .type = THUMB_LONG_BRANCH_AND_LINK, .increments_pc = false, .cycles = 2},
+    [THUMB_OFFSET_STACKPOINTER] = {.execute = thumb_offset_stackpointer, .type = THUMB_OFFSET_STACKPOINTER, .increments_pc = true, .cycles = 1},
+    [THUMB_PUSH_POP_REGISTERS] = {.execute = thumb_push_pop_registers, .type = THUMB_PUSH_POP_REGISTERS, .increments_pc = false, .cycles = 4},
+    [THUMB_LOAD_STORE_HALFWORD] = {.execute = thumb_load_store_halfword, .type = THUMB_LOAD_STORE_HALFWORD, .increments_pc = true, .cycles = 3},
+    [THUMB_SP_RELATIVE_LOAD_STORE] = {.execute = thumb_sp_relative_load_store, .type = THUMB_SP_RELATIVE_LOAD_STORE, .increments_pc = true, .cycles = 3},
+    [THUMB_LOAD_ADDRESS] = {.execute = thumb_load_address, .type = THUMB_LOAD_ADDRESS, .increments_pc = true, .cycles = 1},
+    [THUMB_LOAD_STORE_WITH_OFFSET] = {.execute = thumb_load_store_with_offset, .type = THUMB_LOAD_STORE_WITH_OFFSET, .increments_pc = true, .cycles = 3},
+    [THUMB_LOAD_STORE_WITH_REG_OFFSET] = {.execute = thumb_load_store_with_reg_offset, .type = THUMB_LOAD_STORE_WITH_REG_OFFSET, .increments_pc = true, .cycles = 3},
+    [THUMB_LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD] = {.execute = thumb_load_store_sign_extended_byte_halfword, .type = THUMB_LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD, .increments_pc = true, .cycles = 3},
+    [THUMB_PC_RELATIVE_LOAD] = {.execute = thumb_pc_relative_load, .type = THUMB_PC_RELATIVE_LOAD, .increments_pc = true, .cycles = 3},
+    [THUMB_HI_REG_OPERATION_BRANCH_EXCHANGE] = {.execute = thumb_hi_reg_operation_branch_exchange, .type = THUMB_HI_REG_OPERATION_BRANCH_EXCHANGE, .increments_pc = false, .cycles = 1},
+    [THUMB_ALU_OPERATIONS] = {.execute = thumb_alu_operations, .type = THUMB_ALU_OPERATIONS, .increments_pc = true, .cycles = 1},
+    [THUMB_MOV_CMP_ADD_SUB_IMM] = {.execute = thumb_mov_cmp_add_sub_imm, .type = THUMB_MOV_CMP_ADD_SUB_IMM, .increments_pc = true, .cycles = 1},
+    [THUMB_ADD_SUB] = {.execute = thumb_add_sub, .type = THUMB_ADD_SUB, .increments_pc = true, .cycles = 1},
+    [THUMB_MOVE_SHIFTED_REGISTER] = {.execute = thumb_move_shifted_register, .type = THUMB_MOVE_SHIFTED_REGISTER, .increments_pc = true, .cycles = 1},
+    [THUMB_UNDEFINED] = {.execute = thumb_undefined_instruction, .type = THUMB_UNDEFINED, .increments_pc = false, .cycles = 3},
+};
+
+static struct thumb_decode_entry thumb_decode_table[THUMB_DECODE_TABLE_SIZE];
+static bool thumb_decode_table_ready = false;
+
+// bit n of entry cond is set when cond passes with NZCV == n
+static HALF_WORD condition_table[16];
+static bool condition_table_ready = false;
 
 void cpu_init(struct cpu *cpu)
 {
@@ -6,9 +128,14 @@ void cpu_init(struct cpu *cpu)
     {
         cpu->registers[i] = 0;
     }
-    cpu->registers[SP] = STACK_START;
+    cpu->registers[SP] = USER_STACK_START;
+    cpu->registers[SP_SYS] = USER_STACK_START;
+    cpu->registers[SP_IRQ] = IRQ_STACK_START;
+    cpu->registers[SP_SVC] = SVC_STACK_START;
+    cpu->request_channels = NULL;
     cpu->request_channel_capacity = 0;
     cpu->request_channel_count = 0;
+    memset(cpu->mmio_pages, MMIO_NO_CHANNEL, sizeof(cpu->mmio_pages));
     cpu->registers[CPSR] |= E_MASK;
     cpu->registers[SPSR_ABT] |= E_MASK;
     cpu->registers[SPSR_FIQ] |= E_MASK;
@@ -16,35 +143,114 @@ void cpu_init(struct cpu *cpu)
     cpu->registers[SPSR_SVC] |= E_MASK;
     cpu->registers[SPSR_SYS] |= E_MASK;
     cpu->registers[SPSR_UND] |= E_MASK;
+    cpu_select_memory_accessors(cpu);
+    cpu->flags.op = FLAGS_CLEAN;
     cpu->isOn = true;
+    cpu->cycles = 0;
+    cpu->hle_syscalls = true;
+    cpu->lle_syscalls = 0;
+    scheduler_init(&cpu->scheduler);
+    memory_map_init(&cpu->memory_map);
+    cpu->cartridge = (struct cartridge){.data = NULL, .fd = -1};
+    block_cache_init(&cpu->block_cache);
+#ifdef CPU_JIT
+    cpu->jit = jit_create();
+#else
+    cpu->jit = NULL;
+#endif
+    cpu_build_arm_decode_table();
+    cpu_build_thumb_decode_table();
+    cpu_build_condition_table();
 }
 
 void free_cpu(struct cpu *cpu)
 {
     if (cpu->request_channel_capacity > 0)
     {
+        for (int i = 0; i < cpu->request_channel_count; i++)
+        {
+            free(cpu->request_channels[i].queue);
+        }
         free(cpu->request_channels);
     }
+    block_cache_free(&cpu->block_cache);
+    memory_map_free(&cpu->memory_map);
+    cartridge_unload(&cpu->cartridge);
+#ifdef CPU_JIT
+    jit_destroy(cpu->jit);
+    cpu->jit = NULL;
+#endif
 }
 
 void cpu_loop(struct cpu *cpu)
 {
-    if ((cpu->registers[CPSR] & T_MASK) == T_MASK)
-    {
-        // HALF_WORD instruction = cpu_fetch_thumb_instruction(cpu);
-        cpu->registers[PC] += sizeof(HALF_WORD) / sizeof(BYTE);
-    }
-    else
+    cpu_run(cpu, 1);
+}
+
+int cpu_run(struct cpu *cpu, int cycle_budget)
+{
+    uint64_t start = cpu->cycles;
+    uint64_t end = start + cycle_budget;
+    while (cpu->cycles < end && cpu->isOn)
     {
-        WORD instruction = cpu_fetch_arm_instruction(cpu);
-        if (check_condition(cpu, instruction))
+        uint64_t deadline = scheduler_next_deadline(&cpu->scheduler);
+        if (deadline > end)
         {
-            cpu_execute_arm_instruction(cpu, instruction);
+            deadline = end;
         }
-        else {
-            cpu->registers[PC] += sizeof(WORD) / sizeof(BYTE);
+        while (cpu->cycles < deadline && cpu->isOn)
+        {
+            bool thumb = (cpu->registers[CPSR] & T_MASK) == T_MASK;
+#ifdef CPU_JIT
+            if (cpu->jit != NULL && !thumb)
+            {
+                cpu->cycles += jit_run(cpu, deadline - cpu->cycles);
+                continue;
+            }
+#endif
+            struct block *block = block_cache_lookup(cpu, cpu->registers[PC], thumb);
+            cpu->cycles += block_cache_execute(cpu, block);
+            if (block->idle && cpu->registers[PC] == block->address && cpu->cycles < deadline)
+            {
+                // nothing the loop looks at can change before the next event
+                cpu->block_cache.idle_skips++;
+                cpu->block_cache.idle_cycles_skipped += deadline - cpu->cycles;
+                cpu->cycles = deadline;
+            }
         }
+        // events see the devices with every store the cpu made before them
+        cpu_flush_requests(cpu);
+        scheduler_run_due(cpu);
+    }
+    return cpu->cycles - start;
+}
+
+bool cpu_load_rom(struct cpu *cpu, const char *path)
+{
+    struct cartridge cartridge;
+    if (!cartridge_load(&cartridge, path))
+    {
+        return false;
+    }
+    memory_map_set_rom(&cpu->memory_map, cartridge.data, cartridge.size, cartridge.fd);
+    cartridge_unload(&cpu->cartridge);
+    cpu->cartridge = cartridge;
+    // code translated from the old rom is stale, and so are its idle loops
+    block_cache_flush(&cpu->block_cache);
+    block_cache_clear_idle_overrides(&cpu->block_cache);
+#ifdef CPU_JIT
+    if (cpu->jit != NULL)
+    {
+        jit_flush(cpu->jit);
     }
+#endif
+    if (cartridge.size >= CARTRIDGE_HEADER_SIZE)
+    {
+        char game_code[CARTRIDGE_GAME_CODE_SIZE];
+        memcpy(game_code, cartridge.data + CARTRIDGE_GAME_CODE, CARTRIDGE_GAME_CODE_SIZE);
+        block_cache_load_idle_overrides(&cpu->block_cache, game_code);
+    }
+    return true;
 }
 
 void cpu_print_registers(struct cpu *cpu)
@@ -56,12 +262,13 @@ void cpu_print_registers(struct cpu *cpu)
     printf("SP: %08x\n", cpu->registers[SP]);
     printf("LR: %08x\n", cpu->registers[LR]);
     printf("PC: %08x\n", cpu->registers[PC]);
+    cpu_materialize_flags(cpu);
     printf("CPSR: %08x\n", cpu->registers[CPSR]);
 }
 
 void cpu_print_memory(struct cpu *cpu)
 {
-    for (int i = 0; i < MEMORY_SIZE; i += 0x10)
+    for (int i = 0; i < BIOS_SIZE; i += 0x10)
     {
         printf("%x:", i);
         for (int j = 0; j < 4; j++)
@@ -69,7 +276,7 @@ void cpu_print_memory(struct cpu *cpu)
             printf("\t");
             for (int k = 0; k < 4; k++)
             {
-                printf("%02x", cpu->memory[i + (j * 4) + k]);
+                printf("%02x", read_byte_from_memory(cpu, i + (j * 4) + k));
             }
         }
         printf("\n");
@@ -80,55 +287,23 @@ void cpu_print_instruction(struct cpu *cpu)
 {
     if ((cpu->registers[CPSR] & T_MASK) == T_MASK)
     {
-        printf("Thumb\n");
+        HALF_WORD instruction = cpu_fetch_thumb_instruction(cpu);
+        printf("Thumb %016b\n", instruction);
+
+        printf("\t%s", thumb_instruction_names[cpu_decode_thumb_instruction(instruction)]);
+        printf("\n");
     }
     else
     {
         WORD instruction = cpu_fetch_arm_instruction(cpu);
         printf("ARM %032b\n", instruction);
 
-        enum arm_instruction_set instruction_type = cpu_decode_arm_instruction(instruction);
-        switch (instruction_type)
-        {
-        case BRANCH:
-            printf("\tbranch");
-            break;
-        case BRANCH_AND_EXCHANGE:
-            printf("\tbranch & exchange");
-            break;
-        case SOFTWARE_INTERRUPT:
-            printf("\tsoftware interrupt");
-            break;
-        case UNDEFINED:
-            printf("\tundefined");
-            break;
-        case DATA_PROCESSING:
-            printf("\tdata processing");
-            break;
-        case MULTIPLY:
-            printf("\tmultiply");
-            break;
-        case PSR_TRANSFER:
-            printf("\tpsr transfer");
-            break;
-        case SINGLE_DATA_TRANSFER:
-            printf("\tsingle data transfer");
-            break;
-        case HDS_DATA_TRANSFER:
-            printf("\thds data transfer");
-            break;
-        case BLOCK_DATA_TRANSFER:
-            printf("\tblock data transfer");
-            break;
-        case SINGLE_DATA_SWAP:
-            printf("\tsingle data swap");
-            break;
-        }
+        printf("\t%s", arm_instruction_names[cpu_decode_arm_instruction(instruction)]);
         printf("\n");
     }
 }
 
-enum arm_instruction_set cpu_decode_arm_instruction(WORD instruction)
+static enum arm_instruction_set arm_classify_instruction(WORD instruction)
 {
     if ((instruction & BRANCH_AND_EXCHANGE_OPCODE_MASK) == BRANCH_AND_EXCHANGE_OPCODE)
     {
@@ -158,10 +333,6 @@ enum arm_instruction_set cpu_decode_arm_instruction(WORD instruction)
     {
         return SINGLE_DATA_SWAP;
     }
-    if ((instruction & PSR_TRANSFER_OPCODE_MASK) == PSR_TRANSFER_OPCODE)
-    {
-        return PSR_TRANSFER;
-    }
     if ((instruction & MULTIPLY_OPCODE_MASK) == MULTIPLY_OPCODE)
     {
         if (((instruction & (0b1001 << 4)) == (0b1001 << 4)) ||
@@ -170,10 +341,15 @@ enum arm_instruction_set cpu_decode_arm_instruction(WORD instruction)
             return MULTIPLY;
         }
     }
+    // after multiply, which shares bits 7 and 4, and before psr transfer, whose opcode bits overlap
     if ((instruction & HDS_DATA_TRANSFER_OPCODE_MASK) == HDS_DATA_TRANSFER_OPCODE)
     {
         return HDS_DATA_TRANSFER;
     }
+    if ((instruction & PSR_TRANSFER_OPCODE_MASK) == PSR_TRANSFER_OPCODE)
+    {
+        return PSR_TRANSFER;
+    }
     if ((instruction & DATA_PROCESSING_OPCODE_MASK) == DATA_PROCESSING_OPCODE)
     {
         return DATA_PROCESSING;
@@ -181,6 +357,32 @@ enum arm_instruction_set cpu_decode_arm_instruction(WORD instruction)
     return UNDEFINED;
 }
 
+void cpu_build_arm_decode_table(void)
+{
+    if (arm_decode_table_ready)
+    {
+        return;
+    }
+    for (int i = 0; i < ARM_DECODE_TABLE_SIZE; i++)
+    {
+        // rebuild an instruction from bits 27-20 and 7-4 of the index, bits 19-8 are
+        // set so the "should be one" field of branch and exchange matches its mask
+        WORD instruction = ((i & 0xFF0) << 16) | (0xFFF << 8) | ((i & 0xF) << 4);
+        arm_decode_table[i] = arm_decode_entries[arm_classify_instruction(instruction)];
+    }
+    arm_decode_table_ready = true;
+}
+
+const struct arm_decode_entry *cpu_lookup_arm_instruction(WORD instruction)
+{
+    return &arm_decode_table[ARM_DECODE_INDEX(instruction)];
+}
+
+enum arm_instruction_set cpu_decode_arm_instruction(WORD instruction)
+{
+    return arm_decode_table[ARM_DECODE_INDEX(instruction)].type;
+}
+
 WORD cpu_fetch_arm_instruction(struct cpu *cpu)
 {
     WORD instruction = read_word_from_memory(cpu, cpu->registers[PC]);
@@ -189,52 +391,132 @@ WORD cpu_fetch_arm_instruction(struct cpu *cpu)
 
 void cpu_execute_arm_instruction(struct cpu *cpu, WORD instruction)
 {
-    switch (cpu_decode_arm_instruction(instruction))
+    const struct arm_decode_entry *entry = &arm_decode_table[ARM_DECODE_INDEX(instruction)];
+    entry->execute(cpu, instruction);
+    if (entry->increments_pc)
     {
-    case BRANCH:
-        arm_branch(cpu, instruction);
-        break;
-    case BRANCH_AND_EXCHANGE:
-        arm_branch_and_exchange(cpu, instruction);
-        break;
-    case SOFTWARE_INTERRUPT:
-        arm_software_interrupt(cpu, instruction);
-        break;
-    case UNDEFINED:
-        cpu->registers[PC] = UNDEFINED_INSTRUCTION_VECTOR;
-        //cpu->registers[PC] += sizeof(WORD) / sizeof(BYTE);
-        break;
-    case DATA_PROCESSING:
-        arm_data_processing(cpu, instruction);
-        cpu->registers[PC] += sizeof(WORD) / sizeof(BYTE);
-        break;
-    case MULTIPLY:
-        arm_multiply(cpu, instruction);
-        cpu->registers[PC] += sizeof(WORD) / sizeof(BYTE);
-        break;
-    case PSR_TRANSFER:
-        arm_psr_transfer(cpu, instruction);
-        cpu->registers[PC] += sizeof(WORD) / sizeof(BYTE);
-        break;
-    case SINGLE_DATA_TRANSFER:
-        arm_single_data_transfer(cpu, instruction);
-        cpu->registers[PC] += sizeof(WORD) / sizeof(BYTE);
-        break;
-    case HDS_DATA_TRANSFER:
-        arm_hds_data_transfer(cpu, instruction);
-        cpu->registers[PC] += sizeof(WORD) / sizeof(BYTE);
-        break;
-    case BLOCK_DATA_TRANSFER:
-        arm_block_data_transfer(cpu, instruction);
         cpu->registers[PC] += sizeof(WORD) / sizeof(BYTE);
-        break;
-    case SINGLE_DATA_SWAP:
-        arm_single_data_swap(cpu, instruction);
-        cpu->registers[PC] += sizeof(WORD) / sizeof(BYTE);
-        break;
     }
 }
 
+void arm_undefined_instruction(struct cpu *cpu, WORD instruction)
+{
+    cpu->registers[PC] = UNDEFINED_INSTRUCTION_VECTOR;
+}
+
+void cpu_build_thumb_decode_table(void)
+{
+    if (thumb_decode_table_ready)
+    {
+        return;
+    }
+    for (int i = 0; i < THUMB_DECODE_TABLE_SIZE; i++)
+    {
+        HALF_WORD instruction = i << 6;
+        enum thumb_instruction_set type = THUMB_UNDEFINED;
+        for (int j = 0; j < THUMB_UNDEFINED; j++)
+        {
+            if ((instruction & thumb_opcodes[j].mask) == thumb_opcodes[j].opcode)
+            {
+                type = j;
+                break;
+            }
+        }
+        thumb_decode_table[i] = thumb_decode_entries[type];
+    }
+    thumb_decode_table_ready = true;
+}
+
+static bool condition_passed(int cond, bool n, bool z, bool c, bool v)
+{
+    switch (cond)
+    {
+    case 0x0: // EQ
+        return z;
+    case 0x1: // NE
+        return !z;
+    case 0x2: // CS
+        return c;
+    case 0x3: // CC
+        return !c;
+    case 0x4: // MI
+        return n;
+    case 0x5: // PL
+        return !n;
+    case 0x6: // VS
+        return v;
+    case 0x7: // VC
+        return !v;
+    case 0x8: // HI
+        return c && !z;
+    case 0x9: // LS
+        return !c || z;
+    case 0xa: // GE
+        return n == v;
+    case 0xb: // LT
+        return n != v;
+    case 0xc: // GT
+        return !z && n == v;
+    case 0xd: // LE
+        return z || n != v;
+    case 0xe: // AL
+        return true;
+    default: // NV
+        return false;
+    }
+}
+
+void cpu_build_condition_table(void)
+{
+    if (condition_table_ready)
+    {
+        return;
+    }
+    for (int cond = 0; cond < 16; cond++)
+    {
+        condition_table[cond] = 0;
+        for (int nzcv = 0; nzcv < 16; nzcv++)
+        {
+            if (condition_passed(cond, nzcv & 0b1000, nzcv & 0b0100, nzcv & 0b0010, nzcv & 0b0001))
+            {
+                condition_table[cond] |= 0b1 << nzcv;
+            }
+        }
+    }
+    condition_table_ready = true;
+}
+
+const struct thumb_decode_entry *cpu_lookup_thumb_instruction(HALF_WORD instruction)
+{
+    return &thumb_decode_table[THUMB_DECODE_INDEX(instruction)];
+}
+
+enum thumb_instruction_set cpu_decode_thumb_instruction(HALF_WORD instruction)
+{
+    return thumb_decode_table[THUMB_DECODE_INDEX(instruction)].type;
+}
+
+HALF_WORD cpu_fetch_thumb_instruction(struct cpu *cpu)
+{
+    HALF_WORD instruction = read_half_word_from_memory(cpu, cpu->registers[PC]);
+    return instruction;
+}
+
+void cpu_execute_thumb_instruction(struct cpu *cpu, HALF_WORD instruction)
+{
+    const struct thumb_decode_entry *entry = &thumb_decode_table[THUMB_DECODE_INDEX(instruction)];
+    entry->execute(cpu, instruction);
+    if (entry->increments_pc)
+    {
+        cpu->registers[PC] += sizeof(HALF_WORD) / sizeof(BYTE);
+    }
+}
+
+void thumb_undefined_instruction(struct cpu *cpu, HALF_WORD instruction)
+{
+    cpu->registers[PC] = UNDEFINED_INSTRUCTION_VECTOR;
+}
+
 void arm_single_data_transfer(struct cpu *cpu, WORD instruction)
 {
     enum
@@ -256,10 +538,8 @@ void arm_single_data_transfer(struct cpu *cpu, WORD instruction)
         Rm = 0b1111 << 0,
     };
     uint32_t sd_reg = (instruction & Rd) >> 12;
-    sd_reg = update_register(sd_reg, cpu);
 
     uint8_t address_reg = (instruction & Rn) >> 16;
-    address_reg = update_register(address_reg, cpu);
     int32_t address_offset = 0;
     uint32_t value = 0;
     uint32_t address = cpu->registers[address_reg];
@@ -291,22 +571,13 @@ void arm_single_data_transfer(struct cpu *cpu, WORD instruction)
             cpu->registers[address_reg] = address;
         }
     }
-    if (address >= VIRTUAL_WRAM_CHIP_START && address <= VIRTUAL_IO_REGISTERS) {
-        address = STACK_START;
-    }
+    bool mmio = memory_map_pointer(&cpu->memory_map, address) == NULL;
     if ((instruction & L) == L)
     {
         // LOAD
-        if (address >= MEMORY_SIZE)
+        if (mmio)
         {
-            for (int i = 0; i < cpu->request_channel_count; i++)
-            {
-                if (cpu->request_channels[i].memory_address <= address && cpu->request_channels[i].memory_address + cpu->request_channels[i].memory_range > address)
-                {
-                    data.address = address - cpu->request_channels[i].memory_address;
-                    (*(cpu->request_channels[i].push_to_channel))(&data);
-                }
-            }
+            cpu_request(cpu, address, &data);
             if ((instruction & B) == B)
             {
                 cpu->registers[sd_reg] = data.data.byte;
@@ -323,11 +594,11 @@ void arm_single_data_transfer(struct cpu *cpu, WORD instruction)
                 // only 1 byte
                 if ((cpu->registers[CPSR] & E_MASK) == E_MASK)
                 {
-                    value = cpu->memory[address + (sizeof(WORD) / sizeof(BYTE)) - 1] & 0xFF;
+                    value = read_byte_from_memory(cpu, address + (sizeof(WORD) / sizeof(BYTE)) - 1) & 0xFF;
                 }
                 else
                 {
-                    value = cpu->memory[address] & 0xFF;
+                    value = read_byte_from_memory(cpu, address) & 0xFF;
                 }
             }
             else
@@ -341,7 +612,7 @@ void arm_single_data_transfer(struct cpu *cpu, WORD instruction)
     {
         // STORE
         data.request_type = output;
-        if (address >= MEMORY_SIZE)
+        if (mmio)
         {
             if ((instruction & B) == B)
             {
@@ -352,14 +623,7 @@ void arm_single_data_transfer(struct cpu *cpu, WORD instruction)
             {
                 data.data.word = cpu->registers[sd_reg];
             }
-            for (int i = 0; i < cpu->request_channel_count; i++)
-            {
-                if (cpu->request_channels[i].memory_address <= address && cpu->request_channels[i].memory_address + cpu->request_channels[i].memory_range > address)
-                {
-                    data.address = address - cpu->request_channels[i].memory_address;
-                    (*(cpu->request_channels[i].push_to_channel))(&data);
-                }
-            }
+            cpu_request(cpu, address, &data);
         }
         else
         {
@@ -368,11 +632,11 @@ void arm_single_data_transfer(struct cpu *cpu, WORD instruction)
                 // only 1 byte
                 if ((cpu->registers[CPSR] & E_MASK) == E_MASK)
                 {
-                    cpu->memory[address + (sizeof(WORD) / sizeof(BYTE)) - 1] = cpu->registers[sd_reg] & 0xFF;
+                    write_byte_to_memory(cpu, address + (sizeof(WORD) / sizeof(BYTE)) - 1, cpu->registers[sd_reg] & 0xFF);
                 }
                 else
                 {
-                    cpu->memory[address] = cpu->registers[sd_reg] & 0xFF;
+                    write_byte_to_memory(cpu, address, cpu->registers[sd_reg] & 0xFF);
                 }
             }
             else
@@ -384,31 +648,193 @@ void arm_single_data_transfer(struct cpu *cpu, WORD instruction)
     }
 }
 
-void add_request_channel(struct cpu *cpu, struct request_channel channel)
+// every page points at the lowest channel reaching into it, the lookup walks on from there through the few
+// channels that share the page
+static void build_mmio_pages(struct cpu *cpu)
 {
-    if (channel.push_to_channel == NULL)
+    memset(cpu->mmio_pages, MMIO_NO_CHANNEL, sizeof(cpu->mmio_pages));
+    for (int i = cpu->request_channel_count - 1; i >= 0; i--)
     {
-        return;
+        struct request_channel *channel = &cpu->request_channels[i];
+        WORD first = ((WORD)channel->memory_address & MEMORY_ADDRESS_MASK) >> MMIO_PAGE_SHIFT;
+        WORD last = (((WORD)channel->memory_address + channel->memory_range - 1) & MEMORY_ADDRESS_MASK) >> MMIO_PAGE_SHIFT;
+        for (WORD page = first; page <= last && page < MMIO_PAGE_COUNT; page++)
+        {
+            cpu->mmio_pages[page] = i;
+        }
     }
-    if (cpu->request_channel_capacity == 0)
+}
+
+bool add_request_channel(struct cpu *cpu, struct request_channel channel)
+{
+    if (channel.push_to_channel == NULL || channel.memory_range <= 0)
     {
-        cpu->request_channels = malloc(sizeof(struct request_channel));
-        cpu->request_channel_capacity = 1;
+        return false;
     }
+    WORD start = channel.memory_address;
+    WORD end = start + channel.memory_range;
+    int position = 0;
     for (int i = 0; i < cpu->request_channel_count; i++)
     {
-        if (cpu->request_channels[i].id == channel.id)
+        struct request_channel *other = &cpu->request_channels[i];
+        if (other->id == channel.id)
         {
-            return;
+            return false;
+        }
+        if (start < (WORD)other->memory_address + other->memory_range && (WORD)other->memory_address < end)
+        {
+            printf("Error: channel %s overlaps channel %s at 0x%08x\n", channel.name, other->name, other->memory_address);
+            return false;
+        }
+        if ((WORD)other->memory_address < start)
+        {
+            position = i + 1;
         }
     }
+    if (cpu->request_channel_count == MMIO_MAX_CHANNELS)
+    {
+        printf("Error: too many request channels, ignoring %s\n", channel.name);
+        return false;
+    }
     if (cpu->request_channel_count == cpu->request_channel_capacity)
     {
-        cpu->request_channels = realloc(cpu->request_channels, sizeof(struct request_channel) * (cpu->request_channel_count + 1));
-        cpu->request_channel_capacity++;
+        int capacity = cpu->request_channel_capacity == 0 ? 4 : cpu->request_channel_capacity * 2;
+        struct request_channel *channels = realloc(cpu->request_channels, sizeof(struct request_channel) * capacity);
+        if (channels == NULL)
+        {
+            printf("Error: failed to grow the request channels\n");
+            return false;
+        }
+        cpu->request_channels = channels;
+        cpu->request_channel_capacity = capacity;
+    }
+    channel.queue = NULL;
+    channel.queued = 0;
+    if (channel.queue_length > 0)
+    {
+        channel.queue = malloc(sizeof(struct request_data) * channel.queue_length);
+        if (channel.queue == NULL)
+        {
+            printf("Error: failed to allocate the queue of channel %s, its stores are delivered one at a time\n", channel.name);
+            channel.queue_length = 0;
+        }
     }
-    cpu->request_channels[cpu->request_channel_count] = channel;
+    memmove(&cpu->request_channels[position + 1], &cpu->request_channels[position], sizeof(struct request_channel) * (cpu->request_channel_count - position));
+    cpu->request_channels[position] = channel;
     cpu->request_channel_count++;
+    build_mmio_pages(cpu);
+    // the channel's pages stop being plain memory so every access reaches it
+    memory_map_set_mmio(&cpu->memory_map, channel.memory_address, channel.memory_range, true);
+    return true;
+}
+
+static void flush_request_queue(struct request_channel *channel)
+{
+    int count = channel->queued;
+    channel->queued = 0;
+    if (channel->flush_channel != NULL)
+    {
+        if (count > 0)
+        {
+            channel->flush_channel(channel->queue, count);
+        }
+        return;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        channel->push_to_channel(&channel->queue[i]);
+    }
+}
+
+void cpu_flush_requests(struct cpu *cpu)
+{
+    for (int i = 0; i < cpu->request_channel_count; i++)
+    {
+        if (cpu->request_channels[i].queued > 0)
+        {
+            flush_request_queue(&cpu->request_channels[i]);
+        }
+    }
+}
+
+// a channel claims whole memory pages, the parts of them it does not cover stay plain memory
+static void request_backing_store(struct cpu *cpu, WORD address, struct request_data *data)
+{
+    int size = data->data_type == word ? sizeof(WORD) : data->data_type == half_word ? sizeof(HALF_WORD) : sizeof(BYTE);
+    bool write = data->request_type == output;
+    if (memory_map_backing_pointer(&cpu->memory_map, address, write) == NULL)
+    {
+        return;
+    }
+    // same byte order as the memory accessors, each byte is looked up on its own as an unaligned access may
+    // run off the end of the store
+    bool little = (cpu->registers[CPSR] & E_MASK) == E_MASK;
+    if (write)
+    {
+        WORD value = data->data_type == word ? data->data.word : data->data_type == half_word ? data->data.half_word : data->data.byte;
+        for (int i = 0; i < size; i++)
+        {
+            BYTE *host = memory_map_backing_pointer(&cpu->memory_map, address + (little ? i : size - 1 - i), write);
+            if (host != NULL)
+            {
+                *host = value >> (i * 8);
+            }
+        }
+        block_cache_write(&cpu->block_cache, address, size);
+        memory_map_mark_dirty(&cpu->memory_map, address, size);
+        return;
+    }
+    WORD value = 0;
+    for (int i = 0; i < size; i++)
+    {
+        BYTE *host = memory_map_backing_pointer(&cpu->memory_map, address + (little ? i : size - 1 - i), write);
+        value |= (WORD)(host == NULL ? 0 : *host) << (i * 8);
+    }
+    switch (data->data_type)
+    {
+    case word:
+        data->data.word = value;
+        break;
+    case half_word:
+        data->data.half_word = value;
+        break;
+    case byte:
+        data->data.byte = value;
+        break;
+    }
+}
+
+void cpu_request(struct cpu *cpu, WORD address, struct request_data *data)
+{
+    for (int i = cpu->mmio_pages[(address & MEMORY_ADDRESS_MASK) >> MMIO_PAGE_SHIFT]; i < cpu->request_channel_count; i++)
+    {
+        struct request_channel *channel = &cpu->request_channels[i];
+        if (address < (WORD)channel->memory_address)
+        {
+            break;
+        }
+        if (address - channel->memory_address < (WORD)channel->memory_range)
+        {
+            data->address = address - channel->memory_address;
+            if (channel->queue_length > 0)
+            {
+                if (data->request_type == output)
+                {
+                    if (channel->queued == channel->queue_length)
+                    {
+                        flush_request_queue(channel);
+                    }
+                    channel->queue[channel->queued++] = *data;
+                    return;
+                }
+                // a read has to see every store made before it
+                flush_request_queue(channel);
+            }
+            channel->push_to_channel(data);
+            return;
+        }
+    }
+    request_backing_store(cpu, address, data);
 }
 
 void remove_request_channel(struct cpu *cpu, struct request_channel channel)
@@ -421,13 +847,22 @@ void remove_request_channel(struct cpu *cpu, struct request_channel channel)
             break;
         }
     }
-    while (i < cpu->request_channel_count)
+    if (i == cpu->request_channel_count)
     {
-        cpu->request_channels[i] = cpu->request_channels[i + 1];
-        i++;
+        return;
     }
-    cpu->request_channels[cpu->request_channel_count] = (struct request_channel){0};
+    struct request_channel removed = cpu->request_channels[i];
+    flush_request_queue(&removed);
+    free(removed.queue);
+    memmove(&cpu->request_channels[i], &cpu->request_channels[i + 1], sizeof(struct request_channel) * (cpu->request_channel_count - i - 1));
     cpu->request_channel_count--;
+    build_mmio_pages(cpu);
+    memory_map_set_mmio(&cpu->memory_map, removed.memory_address, removed.memory_range, false);
+    // a page can be shared with a channel that is still there
+    for (i = 0; i < cpu->request_channel_count; i++)
+    {
+        memory_map_set_mmio(&cpu->memory_map, cpu->request_channels[i].memory_address, cpu->request_channels[i].memory_range, true);
+    }
 }
 
 void arm_branch(struct cpu *cpu, WORD instruction)
@@ -487,15 +922,11 @@ void arm_data_processing(struct cpu *cpu, WORD instruction)
         ISI = 0b1111 << 8,
         nn = 0xFF,
     };
-    uint32_t updated_cpsr = cpu->registers[update_register(CPSR, cpu)];
     int opcode = (instruction & OPCODE) >> 21;
     bool s = (instruction & S) == S;
     int32_t rn = (instruction & Rn) >> 16;
     int32_t rd = (instruction & Rd) >> 12;
     int32_t rm = instruction & Rm;
-    rn = update_register(rn, cpu);
-    rd = update_register(rd, cpu);
-    rm = update_register(rm, cpu);
     int op2 = 0;
     if (opcode >= 0x8 && opcode <= 0xB && !s) { // if TEQ, TST, CMP, CMN and S bit is 0 move to PSR
         arm_psr_transfer(cpu, instruction);
@@ -538,117 +969,98 @@ void arm_data_processing(struct cpu *cpu, WORD instruction)
         shift_amount &= 0xFF;
         op2 = shift_immediate(cpu, shift_type, shift_amount, op2);
     }
+    WORD result = 0;
+    bool logical = false;
     switch (opcode)
     {
     case 0x0: // AND
-        cpu->registers[rd] = op1 & op2;
+    case 0x8: // TST
+        result = op1 & op2;
+        logical = true;
         break;
     case 0x1: // EOR
-        cpu->registers[rd] = op1 ^ op2;
+    case 0x9: // TEQ
+        result = op1 ^ op2;
+        logical = true;
         break;
     case 0x2: // SUB
-        cpu->registers[rd] = op1 - op2;
+    case 0xA: // CMP
+        result = op1 - op2;
+        if (s)
+        {
+            cpu_set_sub_flags(cpu, op1, op2, true, result);
+        }
         break;
     case 0x3: // RSB
-        cpu->registers[rd] = op2 - op1;
+        result = op2 - op1;
+        if (s)
+        {
+            cpu_set_sub_flags(cpu, op2, op1, true, result);
+        }
         break;
     case 0x4: // ADD
-        cpu->registers[rd] = op1 + op2;
+    case 0xB: // CMN
+        result = op1 + op2;
+        if (s)
+        {
+            cpu_set_add_flags(cpu, op1, op2, false, result);
+        }
         break;
     case 0x5: // ADC
-        cpu->registers[rd] = op1 + op2 + ((cpu->registers[CPSR] & C_MASK) == C_MASK);
-        break;
-    case 0x6: // SBC
-        cpu->registers[rd] = op1 - op2 + ((cpu->registers[CPSR] & C_MASK) == C_MASK) - 1;
-        break;
-    case 0x7: // RSC
-        cpu->registers[rd] = op2 - op1 + ((cpu->registers[CPSR] & C_MASK) == C_MASK) - 1;
-        break;
-    case 0x8: // TST
-        if ((op1 & op2) == 0)
+    {
+        bool carry = cpu_carry(cpu);
+        result = op1 + op2 + carry;
+        if (s)
         {
-            cpu->registers[CPSR] |= Z_MASK;
-        }
-        else
-        {
-            cpu->registers[CPSR] &= ~Z_MASK;
-            if ((op1 & op2) < 0)
-            {
-                cpu->registers[CPSR] |= N_MASK;
-            }
-            else
-            {
-                cpu->registers[CPSR] &= ~N_MASK;
-            }
+            cpu_set_add_flags(cpu, op1, op2, carry, result);
         }
         break;
-    case 0x9: // TEQ
-        if ((op1 ^ op2) == 0)
+    }
+    case 0x6: // SBC
+    {
+        bool carry = cpu_carry(cpu);
+        result = op1 - op2 + carry - 1;
+        if (s)
         {
-            cpu->registers[CPSR] |= Z_MASK;
-        }
-        else
-        {
-            cpu->registers[CPSR] &= ~Z_MASK;
-            if ((op1 ^ op2) < 0)
-            {
-                cpu->registers[CPSR] |= N_MASK;
-            }
-            else
-            {
-                cpu->registers[CPSR] &= ~N_MASK;
-            }
+            cpu_set_sub_flags(cpu, op1, op2, carry, result);
         }
         break;
-    case 0xA: // CMP
-        if ((op1 & op2) == 0)
-        {
-            cpu->registers[CPSR] |= Z_MASK;
-        }
-        else
+    }
+    case 0x7: // RSC
+    {
+        bool carry = cpu_carry(cpu);
+        result = op2 - op1 + carry - 1;
+        if (s)
         {
-            cpu->registers[CPSR] &= ~Z_MASK;
-            if ((op1 & op2) < 0)
-            {
-                cpu->registers[CPSR] |= N_MASK;
-            }
-            else
-            {
-                cpu->registers[CPSR] &= ~N_MASK;
-            }
+            cpu_set_sub_flags(cpu, op2, op1, carry, result);
         }
         break;
-    case 0xB: // CMN
-        break;
+    }
     case 0xC: // ORR
-        cpu->registers[rd] = op1 | op2;
+        result = op1 | op2;
+        logical = true;
         break;
     case 0xD: // MOV
-        cpu->registers[rd] = op2;
+        result = op2;
+        logical = true;
         break;
     case 0xE: // BIC
-        cpu->registers[rd] = op1 & (~op2);
+        result = op1 & (~op2);
+        logical = true;
         break;
     case 0xF: // MVN
-        cpu->registers[rd] = ~op2;
+        result = ~op2;
+        logical = true;
         break;
     }
-    if (s)
+    // TST, TEQ, CMP and CMN only set flags
+    if (opcode < 0x8 || opcode > 0xB)
     {
-        if ((int32_t)cpu->registers[rd] < 0)
-        {
-            updated_cpsr |= N_MASK;
-            updated_cpsr &= ~Z_MASK;
-        }
-        else if (cpu->registers[rd] == 0)
-        {
-            updated_cpsr |= Z_MASK;
-            updated_cpsr &= ~N_MASK;
-        }
-        else {
-            updated_cpsr &= ~(N_MASK | Z_MASK);
-        }
-        cpu->registers[update_register(CPSR, cpu)] = updated_cpsr;
+        cpu->registers[rd] = result;
+    }
+    if (s && logical)
+    {
+        cpu_set_nz_flags(cpu, result);
     }
 }
 
@@ -694,16 +1106,8 @@ int shift_immediate(struct cpu *cpu, enum shift_type shift_type, int shift_amoun
     case LSR:
         return value >> shift_amount; // does trigger overflow
     case ASR:
-        bool negetive = value < 0;
-        value = value >> shift_amount;
-        if (negetive)
-        {
-            for (int i = 0; i < shift_amount; i++)
-            {
-                value |= 0b1 << (32 - i);
-            }
-        }
-        return value;
+        // value is unsigned, shift it as signed so the sign bit fills in from the top
+        return (int32_t)value >> (shift_amount < 32 ? shift_amount : 31);
     case ROR:
         for (int i = 0; i < shift_amount; i++)
         {
@@ -720,6 +1124,7 @@ int shift_immediate(struct cpu *cpu, enum shift_type shift_type, int shift_amoun
         }
         return value;
     case RCR:
+        cpu_materialize_flags(cpu);
         for (int i = 0; i < shift_amount; i++)
         {
             int c = (cpu->registers[CPSR] & C_MASK) << (31 - C_POS);
@@ -755,10 +1160,17 @@ bool test_overflow(int32_t op1, int32_t op2)
 
 void arm_software_interrupt(struct cpu *cpu, WORD instruction)
 {
-    cpu->registers[SPSR_SVC] = cpu->registers[CPSR];
-    cpu->registers[LR_SVC] = cpu->registers[PC] + sizeof(WORD) / sizeof(BYTE);
-    cpu->registers[CPSR] &= ~(MODE_MASK | T_MASK);
-    cpu->registers[CPSR] |= SVC;
+    if (cpu_hle_syscall(cpu, (instruction >> 16) & 0xFF))
+    {
+        cpu->registers[PC] += sizeof(WORD) / sizeof(BYTE);
+        return;
+    }
+    cpu_materialize_flags(cpu);
+    WORD cpsr = cpu->registers[CPSR];
+    cpu_switch_mode(cpu, SVC);
+    cpu->registers[SPSR_SVC] = cpsr;
+    cpu->registers[LR] = cpu->registers[PC] + sizeof(WORD) / sizeof(BYTE);
+    cpu->registers[CPSR] &= ~T_MASK;
     cpu->registers[PC] = SOFTWARE_INTERRUPT_VECTOR;
 }
 
@@ -783,10 +1195,6 @@ void arm_multiply(struct cpu *cpu, WORD instruction)
     int rn = (instruction & RN) >> 12;
     int rs = (instruction & RS) >> 8;
     int rm = (instruction & RM);
-    rd = update_register(rd, cpu);
-    rn = update_register(rn, cpu);
-    rm = update_register(rm, cpu);
-    rs = update_register(rs, cpu);
     int64_t op1 = cpu->registers[rm];
     int64_t op2 = cpu->registers[rs];
     int64_t rd_hi_low = cpu->registers[rd];
@@ -865,6 +1273,7 @@ void arm_multiply(struct cpu *cpu, WORD instruction)
     }
     if (instruction & S)
     {
+        cpu_materialize_flags(cpu);
         if (result == 0 && uresult == 0)
         {
             cpu->registers[CPSR] |= Z_MASK;
@@ -908,51 +1317,55 @@ void arm_psr_transfer(struct cpu *cpu, WORD instruction)
         SHIFT = 0b1111 << 8,
         IMM = 0b11111111
     };
+    cpu_materialize_flags(cpu);
     uint32_t dst = CPSR;
     if (instruction & PSR)
     {
-        dst = update_register(dst, cpu);
+        dst = cpu_spsr_register(cpu);
     }
     if (instruction & OPCODE) // MSR
     {
         int op = 0;
+        WORD psr = cpu->registers[dst];
         if (instruction & I)
         {
             int shift_amount = instruction & SHIFT;
             shift_amount >>= 8;
             op = shift_immediate(cpu, ROR, shift_amount, instruction & IMM);
         }
-        else
-        {
-            int rm = instruction & RM;
-            rm = update_register(rm, cpu);
-        }
         if (instruction & F)
         {
-            cpu->registers[dst] &= 0x00FFFFFF;
-            cpu->registers[dst] |= op << CPSR_FLAGS;
+            psr &= 0x00FFFFFF;
+            psr |= op << CPSR_FLAGS;
         }
         else if (instruction & S)
         {
-            cpu->registers[dst] &= 0xFF00FFFF;
-            cpu->registers[dst] |= op << CPSR_STATUS;
+            psr &= 0xFF00FFFF;
+            psr |= op << CPSR_STATUS;
         }
         else if (instruction & X)
         {
-            cpu->registers[dst] &= 0xFFFF00FF;
-            cpu->registers[dst] |= op << CPSR_EXTENTION;
+            psr &= 0xFFFF00FF;
+            psr |= op << CPSR_EXTENTION;
         }
         else if (instruction & C)
         {
-            cpu->registers[dst] &= 0xFFFFFF00;
-            cpu->registers[dst] |= op << CPSR_CONTROL;
+            psr &= 0xFFFFFF00;
+            psr |= op << CPSR_CONTROL;
+        }
+        if (dst == CPSR)
+        {
+            cpu_set_cpsr(cpu, psr);
+        }
+        else
+        {
+            cpu->registers[dst] = psr;
         }
     }
     else // MRS
     {
         int rd = instruction & RD;
         rd >>= 12;
-        rd = update_register(rd, cpu);
         cpu->registers[rd] = cpu->registers[dst];
     }
 }
@@ -981,8 +1394,6 @@ void arm_hds_data_transfer(struct cpu *cpu, WORD instruction)
     rn >>= 16;
     rd >>= 12;
     int base = 0;
-    rn = update_register(rn, cpu);
-    rd = update_register(rd, cpu);
     base = cpu->registers[rn];
     int offset = 0;
     if (instruction & I)
@@ -993,7 +1404,6 @@ void arm_hds_data_transfer(struct cpu *cpu, WORD instruction)
     else
     {
         int rm = instruction & RM;
-        rm = update_register(rm, cpu);
         offset = cpu->registers[rm];
     }
     if ((instruction & U) != U)
@@ -1011,7 +1421,7 @@ void arm_hds_data_transfer(struct cpu *cpu, WORD instruction)
     if (instruction & L)
     {
         // STR halfword
-        cpu->memory[base] = cpu->registers[rd];
+        write_byte_to_memory(cpu, base, cpu->registers[rd]);
     }
     else
     {
@@ -1019,17 +1429,17 @@ void arm_hds_data_transfer(struct cpu *cpu, WORD instruction)
         {
         case 0b01: // load unsigned halfword
             cpu->registers[rd] = 0;
-            cpu->registers[rd] |= cpu->memory[base];
+            cpu->registers[rd] |= read_byte_from_memory(cpu, base);
             cpu->registers[rd] <<= 8;
-            cpu->registers[rd] |= cpu->memory[base + 1];
+            cpu->registers[rd] |= read_byte_from_memory(cpu, base + 1);
             break;
         case 0b10: // load signed byte
-            cpu->registers[rd] = cpu->memory[base];
+            cpu->registers[rd] = read_byte_from_memory(cpu, base);
             break;
         case 0b11: // load signed halfword
-            cpu->registers[rd] = cpu->memory[base];
+            cpu->registers[rd] = read_byte_from_memory(cpu, base);
             cpu->registers[rd] <<= 8;
-            cpu->registers[rd] |= cpu->memory[base + 1];
+            cpu->registers[rd] |= read_byte_from_memory(cpu, base + 1);
             break;
         }
     }
@@ -1091,26 +1501,9 @@ void arm_block_data_transfer(struct cpu *cpu, WORD instruction)
         {
             enum cpu_mode mode = cpu->registers[CPSR] & MODE_MASK;
             bool thumb = (cpu->registers[CPSR] & T_MASK) >> T_POS;
-            switch (mode)
+            if (mode != USER && mode != SYS)
             {
-            case USER:
-            case SYS:
-                break;
-            case SVC:
-                cpu->registers[CPSR] = cpu->registers[SPSR_SVC];
-                break;
-            case ABT:
-                cpu->registers[CPSR] = cpu->registers[SPSR_ABT];
-                break;
-            case UND:
-                cpu->registers[CPSR] = cpu->registers[SPSR_UND];
-                break;
-            case IRQ:
-                cpu->registers[CPSR] = cpu->registers[SPSR_IRQ];
-                break;
-            case FIQ:
-                cpu->registers[CPSR] = cpu->registers[SPSR_FIQ];
-                break;
+                cpu_set_cpsr(cpu, cpu->registers[cpu_spsr_register(cpu)]);
             }
             if (thumb)
             {
@@ -1135,8 +1528,7 @@ void arm_block_data_transfer(struct cpu *cpu, WORD instruction)
         }
         if (instruction & S)
         {
-            cpu->registers[CPSR] ^= cpu->registers[CPSR] & MODE_MASK;
-            cpu->registers[CPSR] |= USER << MODE_POS;
+            cpu_switch_mode(cpu, USER);
         }
     }
     if ((instruction & P) != P)
@@ -1173,10 +1565,10 @@ void arm_single_data_swap(struct cpu *cpu, WORD instruction)
     int rm_value = cpu->registers[rm]; // in case that rm = rd
     if (instruction & B)
     {
-        cpu->registers[rd] = cpu->memory[cpu->registers[rn]];
+        cpu->registers[rd] = read_byte_from_memory(cpu, cpu->registers[rn]);
         cpu->registers[rd] &= UINT8_MAX; // for when [rn] is negetive
         rm_value &= UINT8_MAX;
-        cpu->memory[cpu->registers[rn]] = rm_value;
+        write_byte_to_memory(cpu, cpu->registers[rn], rm_value);
     }
     else
     {
@@ -1187,6 +1579,18 @@ void arm_single_data_swap(struct cpu *cpu, WORD instruction)
 
 void thumb_software_interrupt(struct cpu *cpu, HALF_WORD instruction)
 {
+    if (cpu_hle_syscall(cpu, instruction & 0xFF))
+    {
+        cpu->registers[PC] += sizeof(HALF_WORD) / sizeof(BYTE);
+        return;
+    }
+    cpu_materialize_flags(cpu);
+    WORD cpsr = cpu->registers[CPSR];
+    cpu_switch_mode(cpu, SVC);
+    cpu->registers[SPSR_SVC] = cpsr;
+    cpu->registers[LR] = cpu->registers[PC] + sizeof(HALF_WORD) / sizeof(BYTE);
+    cpu->registers[CPSR] &= ~T_MASK;
+    cpu->registers[PC] = SOFTWARE_INTERRUPT_VECTOR;
 }
 
 void thumb_unconditional_branch(struct cpu *cpu, HALF_WORD instruction)
@@ -1195,8 +1599,12 @@ void thumb_unconditional_branch(struct cpu *cpu, HALF_WORD instruction)
     {
         NN = 0b11111111111
     };
-    int nn = (int16_t)(instruction & NN);
-    cpu->registers[PC] += nn << 1;
+    int32_t nn = instruction & NN;
+    if (nn & (0b1 << 10)) // checks if offset should be negative
+    {
+        nn |= ~NN;
+    }
+    cpu->registers[PC] += 4 + (nn << 1);
 }
 
 void thumb_conditional_branch(struct cpu *cpu, HALF_WORD instruction)
@@ -1206,61 +1614,17 @@ void thumb_conditional_branch(struct cpu *cpu, HALF_WORD instruction)
         OPCODE = 0b1111 << 8,
         NN = 0b11111111
     };
-    bool branch = false;
     int opcode = instruction & OPCODE;
     int nn = (int8_t)(instruction & NN);
-
-    switch (opcode >> 8)
-    {
-    case 0x0: // BEQ
-        branch = cpu->registers[CPSR] & Z_MASK;
-        break;
-    case 0x1: // BNE
-        branch = !(cpu->registers[CPSR] & Z_MASK);
-        break;
-    case 0x2: // BCS
-        branch = cpu->registers[CPSR] & C_MASK;
-        break;
-    case 0x3: // BCC
-        branch = !(cpu->registers[CPSR] & C_MASK);
-        break;
-    case 0x4: // BMI
-        branch = cpu->registers[CPSR] & N_MASK;
-        break;
-    case 0x5: // BPL
-        branch = !(cpu->registers[CPSR] & N_MASK);
-        break;
-    case 0x6: // BVS
-        branch = cpu->registers[CPSR] & V_MASK;
-        break;
-    case 0x7: // BVC
-        branch = !(cpu->registers[CPSR] & V_MASK);
-        break;
-    case 0x8: // BHI
-        branch = cpu->registers[CPSR] & C_MASK && !(cpu->registers[CPSR] & Z_MASK);
-        break;
-    case 0x9: // BLS
-        branch = !(cpu->registers[CPSR] & C_MASK) || (cpu->registers[CPSR] & Z_MASK);
-        break;
-    case 0xa: // BGE
-        branch = ((cpu->registers[CPSR] & N_MASK) == 0) == ((cpu->registers[CPSR] & V_MASK) == 0);
-        break;
-    case 0xb: // BLT
-        branch = ((cpu->registers[CPSR] & N_MASK) == 0) != ((cpu->registers[CPSR] & V_MASK) == 0);
-        break;
-    case 0xc: // BGT
-        branch = ((cpu->registers[CPSR] & Z_MASK) == 0) && ((cpu->registers[CPSR] & N_MASK) == 0) && ((cpu->registers[CPSR] & V_MASK) == 0);
-        break;
-    case 0xd: // BLE
-        branch = ((cpu->registers[CPSR] & Z_MASK) != 0) || ((cpu->registers[CPSR] & N_MASK) != 0) || ((cpu->registers[CPSR] & V_MASK) != 0);
-        break;
     // 0xe is undefined and 0xf is reserved
-    default:
-        break;
-    }
+    bool branch = (opcode >> 8) < 0xE && cpu_check_condition_code(cpu, opcode >> 8);
     if (branch)
     {
-        cpu->registers[PC] += nn << 1;
+        cpu->registers[PC] += 4 + (nn << 1);
+    }
+    else
+    {
+        cpu->registers[PC] += sizeof(HALF_WORD) / sizeof(BYTE);
     }
 }
 
@@ -1275,7 +1639,6 @@ void thumb_multiple_load_store(struct cpu *cpu, HALF_WORD instruction)
     int opcode = instruction & OPCODE;
     int rb = instruction & RB;
     rb >>= 8;
-    rb++;
     int rlist = instruction & RLIST;
     // undefined behaviour of armv4
     if (rlist == 0)
@@ -1314,6 +1677,29 @@ void thumb_multiple_load_store(struct cpu *cpu, HALF_WORD instruction)
 
 void thumb_long_branch_and_link(struct cpu *cpu, HALF_WORD instruction)
 {
+    enum
+    {
+        H = 0b1 << 11,
+        NN = 0b11111111111
+    };
+    int32_t nn = instruction & NN;
+    if ((instruction & H) != H)
+    {
+        // first half, upper 11 bits of the offset
+        if (nn & (0b1 << 10))
+        {
+            nn |= ~NN;
+        }
+        cpu->registers[LR] = cpu->registers[PC] + 4 + (nn << 12);
+        cpu->registers[PC] += sizeof(HALF_WORD) / sizeof(BYTE);
+    }
+    else
+    {
+        // second half, lower 11 bits of the offset
+        WORD next = cpu->registers[PC] + sizeof(HALF_WORD) / sizeof(BYTE);
+        cpu->registers[PC] = cpu->registers[LR] + (nn << 1);
+        cpu->registers[LR] = next | 0b1;
+    }
 }
 
 void thumb_offset_stackpointer(struct cpu *cpu, HALF_WORD instruction)
@@ -1371,8 +1757,9 @@ void thumb_push_pop_registers(struct cpu *cpu, HALF_WORD instruction)
         if (opcode)
         {
             // POP PC
-            cpu->registers[PC] = read_word_from_memory(cpu, cpu->registers[SP]);
+            cpu->registers[PC] = read_word_from_memory(cpu, cpu->registers[SP]) & ~0b1;
             cpu->registers[SP] += sizeof(WORD);
+            return;
         }
         else
         {
@@ -1381,6 +1768,7 @@ void thumb_push_pop_registers(struct cpu *cpu, HALF_WORD instruction)
             cpu->registers[SP] -= sizeof(WORD);
         }
     }
+    cpu->registers[PC] += sizeof(HALF_WORD) / sizeof(BYTE);
 }
 
 void thumb_load_store_halfword(struct cpu *cpu, HALF_WORD instruction)
@@ -1397,9 +1785,7 @@ void thumb_load_store_halfword(struct cpu *cpu, HALF_WORD instruction)
     nn >>= 6;
     int rb = instruction & RB;
     rb >>= 3;
-    rb++;
     int rd = instruction & RD;
-    rd++;
     if (opcode)
     {
         // LDRH
@@ -1423,7 +1809,6 @@ void thumb_sp_relative_load_store(struct cpu *cpu, HALF_WORD instruction)
     int opcode = instruction & OPCODE;
     int rd = instruction & RD;
     rd >>= 8;
-    rd++;
     int nn = instruction & NN;
 
     if (opcode)
@@ -1456,9 +1841,7 @@ void thumb_load_store_with_offset(struct cpu *cpu, HALF_WORD instruction)
     nn >>= 6;
     int rb = instruction & RB;
     rb >>= 3;
-    rb++;
     int rd = instruction & RD;
-    rd++;
     switch (opcode >> 11)
     {
     case 0b00: // STR
@@ -1468,10 +1851,10 @@ void thumb_load_store_with_offset(struct cpu *cpu, HALF_WORD instruction)
         cpu->registers[rd] = read_word_from_memory(cpu, cpu->registers[rb] + nn);
         break;
     case 0b10: // STRB
-        cpu->memory[cpu->registers[rb] + nn] = cpu->registers[rd] & 0xFF;
+        write_byte_to_memory(cpu, cpu->registers[rb] + nn, cpu->registers[rd] & 0xFF);
         break;
     case 0b11: // LDRB
-        cpu->registers[rd] = 0 | cpu->memory[cpu->registers[rb] + nn];
+        cpu->registers[rd] = 0 | read_byte_from_memory(cpu, cpu->registers[rb] + nn);
         break;
     }
 }
@@ -1489,25 +1872,22 @@ void thumb_load_store_with_reg_offset(struct cpu *cpu, HALF_WORD instruction)
     opcode >>= 10;
     int ro = instruction & RO;
     ro >>= 6;
-    ro++;
     int rb = instruction & RB;
     rb >>= 3;
-    rb++;
     int rd = instruction & RD;
-    rd++;
     switch (opcode)
     {
     case 0b00: // STR
         write_word_to_memory(cpu, cpu->registers[rb] + cpu->registers[ro], cpu->registers[rd]);
         break;
     case 0b01: // STRB
-        cpu->memory[cpu->registers[rb] + cpu->registers[ro]] = cpu->registers[rd] & 0xFF;
+        write_byte_to_memory(cpu, cpu->registers[rb] + cpu->registers[ro], cpu->registers[rd] & 0xFF);
         break;
     case 0b10: // LDR
         cpu->registers[rd] = read_word_from_memory(cpu, cpu->registers[rb] + cpu->registers[ro]);
         break;
     case 0b11: // LDRB
-        cpu->registers[rd] = 0 | cpu->memory[cpu->registers[rb] + cpu->registers[ro]];
+        cpu->registers[rd] = 0 | read_byte_from_memory(cpu, cpu->registers[rb] + cpu->registers[ro]);
         break;
     }
 }
@@ -1524,19 +1904,16 @@ void thumb_load_store_sign_extended_byte_halfword(struct cpu *cpu, HALF_WORD ins
     int opcode = instruction & OPCODE;
     int ro = instruction & RO;
     ro >>= 6;
-    ro++;
     int rb = instruction & RB;
     rb >>= 3;
-    rb++;
     int rd = instruction & RD;
-    rd++;
     switch (opcode >> 10)
     {
     case 0b00: // STRH
         write_half_word_to_memory(cpu, cpu->registers[rb] + cpu->registers[ro], cpu->registers[rd]);
         break;
     case 0b01: // LDSB
-        cpu->registers[rd] = cpu->memory[cpu->registers[rb] + cpu->registers[ro]] & 0xFF;
+        cpu->registers[rd] = read_byte_from_memory(cpu, cpu->registers[rb] + cpu->registers[ro]) & 0xFF;
         if (cpu->registers[rd] & (0b1 << 7))
         {
             cpu->registers[rd] |= (UINT32_MAX << 8);
@@ -1564,7 +1941,6 @@ void thumb_pc_relative_load(struct cpu *cpu, HALF_WORD instruction)
     };
     int rd = instruction & RD;
     rd >>= 8;
-    rd++;
     int nn = instruction & NN;
     cpu->registers[rd] = read_word_from_memory(cpu, cpu->registers[PC] + nn);
 }
@@ -1580,47 +1956,46 @@ void thumb_hi_reg_operation_branch_exchange(struct cpu *cpu, HALF_WORD instructi
         RD = 0b111
     };
     int opcode = instruction & OPCODE;
-    int rs = instruction & MSBS;
-    rs |= instruction & RS;
+    int rs = instruction & (MSBS | RS);
     rs >>= 3;
-    rs++;
-    if (rs > 0xF)
-    {
-        rs = PC;
-    }
-    int rd = instruction & MSBS;
+    int rd = instruction & MSBD;
     rd >>= 4;
     rd |= instruction & RD;
-    rd++;
-    if (rd > 0xF)
-    {
-        rd = PC;
-    }
     switch (opcode >> 8)
     {
     case 0b00: // ADD
         cpu->registers[rd] += cpu->registers[rs];
         break;
     case 0b01: // CMP
-        int result = cpu->registers[rd] - cpu->registers[rs];
-        if (result == 0)
-        {
-            cpu->registers[CPSR] |= Z_MASK;
-            cpu->registers[CPSR] &= ~N_MASK;
-        }
-        else if (result < 0)
-        {
-            cpu->registers[CPSR] &= ~Z_MASK;
-            cpu->registers[CPSR] |= N_MASK;
-        }
+        cpu_set_sub_flags(cpu, cpu->registers[rd], cpu->registers[rs], true, cpu->registers[rd] - cpu->registers[rs]);
         break;
     case 0b10: // MOV
         cpu->registers[rd] = cpu->registers[rs];
         break;
     case 0b11: // BX
-        cpu->registers[PC] = cpu->registers[rs];
-        cpu->registers[CPSR] &= ~T_MASK;
-        break;
+    {
+        WORD target = cpu->registers[rs];
+        if (target & 0b1)
+        {
+            cpu->registers[CPSR] |= T_MASK;
+            cpu->registers[PC] = target & ~0b1;
+        }
+        else
+        {
+            cpu->registers[CPSR] &= ~T_MASK;
+            cpu->registers[PC] = target & ~0b11;
+        }
+        return;
+    }
+    }
+    // the decode entry does not advance pc, writes to pc are branches
+    if (rd == PC && (opcode >> 8) != 0b01)
+    {
+        cpu->registers[PC] &= ~0b1;
+    }
+    else
+    {
+        cpu->registers[PC] += sizeof(HALF_WORD) / sizeof(BYTE);
     }
 }
 
@@ -1635,9 +2010,7 @@ void thumb_alu_operations(struct cpu *cpu, HALF_WORD instruction)
     int opcode = instruction & OPCODE;
     int rs = instruction & RS;
     rs >>= 3;
-    rs++;
     int rd = instruction & RD;
-    rd++;
     /*     0: AND{S} Rd,Rs     ;AND logical       Rd = Rd AND Rs
            1: EOR{S} Rd,Rs     ;XOR logical       Rd = Rd XOR Rs
            2: LSL{S} Rd,Rs     ;log. shift left   Rd = Rd << (Rs AND 0FFh)
@@ -1654,111 +2027,70 @@ void thumb_alu_operations(struct cpu *cpu, HALF_WORD instruction)
            D: MUL{S} Rd,Rs     ;multiply          Rd = Rd * Rs
            E: BIC{S} Rd,Rs     ;bit clear         Rd = Rd AND NOT Rs
            F: MVN{S}*/
-    int result = 0;
+    WORD op1 = cpu->registers[rd];
+    WORD op2 = cpu->registers[rs];
+    WORD result = 0;
     switch (opcode >> 6)
     {
     case 0b0000: // AND
-        cpu->registers[rd] &= cpu->registers[rs];
-        result = cpu->registers[rd];
+        result = cpu->registers[rd] = op1 & op2;
         break;
     case 0b0001: // EOR
-        cpu->registers[rd] ^= cpu->registers[rs];
-        result = cpu->registers[rd];
+        result = cpu->registers[rd] = op1 ^ op2;
         break;
     case 0b0010: // LSL
-        cpu->registers[rd] = shift_immediate(cpu, LSL, cpu->registers[rs], cpu->registers[rd]);
-        result = cpu->registers[rd];
+        result = cpu->registers[rd] = shift_immediate(cpu, LSL, op2, op1);
         break;
     case 0b0011: // LSR
-        cpu->registers[rd] = shift_immediate(cpu, LSR, cpu->registers[rs], cpu->registers[rd]);
-        result = cpu->registers[rd];
+        result = cpu->registers[rd] = shift_immediate(cpu, LSR, op2, op1);
         break;
     case 0b0100: // ASR
-        cpu->registers[rd] = shift_immediate(cpu, ASR, cpu->registers[rs], cpu->registers[rd]);
-        result = cpu->registers[rd];
+        result = cpu->registers[rd] = shift_immediate(cpu, ASR, op2, op1);
         break;
     case 0b0101: // ADC
-        if (cpu->registers[CPSR] & C_MASK)
-        {
-            cpu->registers[rd]++;
-        }
-        if (test_overflow(cpu->registers[rd], cpu->registers[rs]))
-        {
-            cpu->registers[CPSR] |= V_MASK | C_MASK;
-        }
-        else
-        {
-            cpu->registers[CPSR] &= ~(V_MASK | C_MASK);
-        }
-        cpu->registers[rd] += cpu->registers[rs];
-        result = cpu->registers[rd];
-        break;
+    {
+        bool carry = cpu_carry(cpu);
+        result = cpu->registers[rd] = op1 + op2 + carry;
+        cpu_set_add_flags(cpu, op1, op2, carry, result);
+        return;
+    }
     case 0b0110: // SBC
-        if (cpu->registers[CPSR] & C_MASK)
-        {
-            cpu->registers[rd]--;
-        }
-        else
-        {
-            cpu->registers[rd]++;
-        }
-        cpu->registers[CPSR] &= ~C_MASK;
-        if (test_overflow(cpu->registers[rd], -cpu->registers[rs]))
-        {
-            cpu->registers[CPSR] |= V_MASK;
-        }
-        else
-        {
-            cpu->registers[CPSR] &= ~V_MASK;
-        }
-        result = cpu->registers[rd];
-        break;
+    {
+        bool carry = cpu_carry(cpu);
+        result = cpu->registers[rd] = op1 - op2 + carry - 1;
+        cpu_set_sub_flags(cpu, op1, op2, carry, result);
+        return;
+    }
     case 0b0111: // ROR
-        cpu->registers[rd] = (cpu->registers[rd] >> cpu->registers[rs]) | (cpu->registers[rd] << (sizeof(WORD) * __CHAR_BIT__ - cpu->registers[rs]));
-        result = cpu->registers[rd];
+        result = cpu->registers[rd] = (op1 >> op2) | (op1 << (sizeof(WORD) * __CHAR_BIT__ - op2));
         break;
     case 0b1000: // TST
-        cpu->registers[CPSR] &= ~(N_MASK | Z_MASK);
-        result = cpu->registers[rd] & cpu->registers[rs];
+        result = op1 & op2;
         break;
     case 0b1001: // NEG
-        cpu->registers[rd] = 0 - cpu->registers[rs];
-        result = cpu->registers[rd];
-        break;
+        result = cpu->registers[rd] = 0 - op2;
+        cpu_set_sub_flags(cpu, 0, op2, true, result);
+        return;
     case 0b1010: // CMP
-        result = cpu->registers[rd] - cpu->registers[rs];
-        break;
+        cpu_set_sub_flags(cpu, op1, op2, true, op1 - op2);
+        return;
     case 0b1011: // CMN
-        result = cpu->registers[rd] + cpu->registers[rs];
-        break;
+        cpu_set_add_flags(cpu, op1, op2, false, op1 + op2);
+        return;
     case 0b1100: // ORR
-        cpu->registers[rd] |= cpu->registers[rs];
-        result = cpu->registers[rd];
+        result = cpu->registers[rd] = op1 | op2;
         break;
     case 0b1101: // MUL
-        cpu->registers[rd] *= cpu->registers[rs];
-        result = cpu->registers[rd];
-        cpu->registers[CPSR] &= ~C_MASK;
+        result = cpu->registers[rd] = op1 * op2;
         break;
     case 0b1110: // BIC
-        cpu->registers[rd] &= ~cpu->registers[rs];
-        result = cpu->registers[rd];
+        result = cpu->registers[rd] = op1 & ~op2;
         break;
     case 0b1111: // MVN
-        cpu->registers[rd] = ~cpu->registers[rs];
-        result = cpu->registers[rd];
+        result = cpu->registers[rd] = ~op2;
         break;
     }
-    if (result == 0)
-    {
-        cpu->registers[CPSR] |= Z_MASK;
-        cpu->registers[CPSR] &= ~N_MASK;
-    }
-    else if (result < 0)
-    {
-        cpu->registers[CPSR] |= N_MASK;
-        cpu->registers[CPSR] &= ~Z_MASK;
-    }
+    cpu_set_nz_flags(cpu, result);
 }
 
 void thumb_mov_cmp_add_sub_imm(struct cpu *cpu, HALF_WORD instruction)
@@ -1773,85 +2105,24 @@ void thumb_mov_cmp_add_sub_imm(struct cpu *cpu, HALF_WORD instruction)
     opcode >>= 11;
     int rd = instruction & RD;
     rd >>= 8;
-    rd++;
     int imm = instruction & NN;
+    WORD op1 = cpu->registers[rd];
     switch (opcode)
     {
     case 0b00: // MOV
         cpu->registers[rd] = imm;
-        if (imm == 0)
-        {
-            cpu->registers[CPSR] |= Z_MASK;
-            cpu->registers[CPSR] &= ~N_MASK;
-        }
-        else if (imm < 0)
-        {
-            cpu->registers[CPSR] |= N_MASK;
-            cpu->registers[CPSR] &= ~Z_MASK;
-        }
+        cpu_set_nz_flags(cpu, imm);
         break;
     case 0b01: // CMP
-        int result = cpu->registers[rd] - imm;
-        cpu->registers[CPSR] &= ~C_MASK;
-        if (test_overflow(cpu->registers[rd], -imm))
-        {
-            cpu->registers[CPSR] |= V_MASK;
-        }
-        else
-        {
-            cpu->registers[CPSR] &= ~V_MASK;
-        }
-        if (result == 0)
-        {
-            cpu->registers[CPSR] |= Z_MASK;
-            cpu->registers[CPSR] &= ~N_MASK;
-        }
-        else if (result < 0)
-        {
-            cpu->registers[CPSR] |= N_MASK;
-            cpu->registers[CPSR] &= ~Z_MASK;
-        }
+        cpu_set_sub_flags(cpu, op1, imm, true, op1 - imm);
+        break;
     case 0b10: // ADD
-        if (test_overflow(cpu->registers[rd], imm))
-        {
-            cpu->registers[CPSR] |= V_MASK | C_MASK;
-        }
-        else
-        {
-            cpu->registers[CPSR] &= ~(V_MASK | C_MASK);
-        }
-        cpu->registers[rd] += imm;
-        if (cpu->registers[rd] == 0)
-        {
-            cpu->registers[CPSR] |= Z_MASK;
-            cpu->registers[CPSR] &= ~N_MASK;
-        }
-        else if (cpu->registers[rd] < 0)
-        {
-            cpu->registers[CPSR] |= N_MASK;
-            cpu->registers[CPSR] &= ~Z_MASK;
-        }
+        cpu->registers[rd] = op1 + imm;
+        cpu_set_add_flags(cpu, op1, imm, false, cpu->registers[rd]);
         break;
     case 0b11: // SUB
-        if (test_overflow(cpu->registers[rd], -imm))
-        {
-            cpu->registers[CPSR] |= V_MASK | C_MASK;
-        }
-        else
-        {
-            cpu->registers[CPSR] &= ~(V_MASK | C_MASK);
-        }
-        cpu->registers[rd] -= imm;
-        if (cpu->registers[rd] == 0)
-        {
-            cpu->registers[CPSR] |= Z_MASK;
-            cpu->registers[CPSR] &= ~N_MASK;
-        }
-        else if (cpu->registers[rd] < 0)
-        {
-            cpu->registers[CPSR] |= N_MASK;
-            cpu->registers[CPSR] &= ~Z_MASK;
-        }
+        cpu->registers[rd] = op1 - imm;
+        cpu_set_sub_flags(cpu, op1, imm, true, cpu->registers[rd]);
         break;
     }
 }
@@ -1868,72 +2139,32 @@ void thumb_add_sub(struct cpu *cpu, HALF_WORD instruction)
     };
     int rn = instruction & RN;
     rn >>= 6;
-    rn++;
     int imm = instruction & NN;
     imm >>= 6;
     int rs = instruction & RS;
     rs >>= 3;
-    rs++;
     int rd = instruction & RD;
-    rd++;
     int opcode = instruction & OPCODE;
+    WORD op1 = cpu->registers[rn];
     switch (opcode >> 9)
     {
     case 0b00: // add reg
-        cpu->registers[rd] = cpu->registers[rn] + cpu->registers[rs];
-        if (test_overflow(cpu->registers[rs], cpu->registers[rn]))
-        {
-            cpu->registers[CPSR] |= V_MASK | C_MASK;
-        }
-        else
-        {
-            cpu->registers[CPSR] &= ~(V_MASK | C_MASK);
-        }
+        cpu->registers[rd] = op1 + cpu->registers[rs];
+        cpu_set_add_flags(cpu, op1, cpu->registers[rs], false, cpu->registers[rd]);
         break;
     case 0b01: // sub reg
-        cpu->registers[rd] = cpu->registers[rn] - cpu->registers[rs];
-        if (test_overflow(cpu->registers[rs], -cpu->registers[rn]))
-        {
-            cpu->registers[CPSR] |= V_MASK;
-        }
-        else
-        {
-            cpu->registers[CPSR] &= ~V_MASK;
-        }
+        cpu->registers[rd] = op1 - cpu->registers[rs];
+        cpu_set_sub_flags(cpu, op1, cpu->registers[rs], true, cpu->registers[rd]);
         break;
     case 0b10: // add imm
-        cpu->registers[rd] = cpu->registers[rn] + imm;
-        if (test_overflow(cpu->registers[rs], imm))
-        {
-            cpu->registers[CPSR] |= V_MASK | C_MASK;
-        }
-        else
-        {
-            cpu->registers[CPSR] &= ~(V_MASK | C_MASK);
-        }
+        cpu->registers[rd] = op1 + imm;
+        cpu_set_add_flags(cpu, op1, imm, false, cpu->registers[rd]);
         break;
     case 0b11: // sub imm
-        cpu->registers[rd] = cpu->registers[rn] - imm;
-        if (test_overflow(cpu->registers[rs], -imm))
-        {
-            cpu->registers[CPSR] |= V_MASK;
-        }
-        else
-        {
-            cpu->registers[CPSR] &= ~V_MASK;
-        }
+        cpu->registers[rd] = op1 - imm;
+        cpu_set_sub_flags(cpu, op1, imm, true, cpu->registers[rd]);
         break;
     }
-    if (cpu->registers[rd] == 0)
-    {
-        cpu->registers[CPSR] |= Z_MASK;
-        cpu->registers[CPSR] &= ~N_MASK;
-    }
-    else if (cpu->registers[rd])
-    {
-        cpu->registers[CPSR] |= N_MASK;
-        cpu->registers[CPSR] &= ~Z_MASK;
-    }
 }
 
 void thumb_move_shifted_register(struct cpu *cpu, HALF_WORD instruction)
@@ -1948,229 +2179,359 @@ void thumb_move_shifted_register(struct cpu *cpu, HALF_WORD instruction)
     int opcode = instruction & OPCODE;
     int rs = instruction & RS;
     rs >>= 3;
-    rs++;
     int rd = instruction & RD;
-    rd++;
     int offset = instruction & OFFSET;
     offset >>= 6;
-    cpu->registers[rd] = shift_immediate(cpu, opcode >> 11, cpu->registers[rs], offset);
-    if (cpu->registers[rd] == 0)
+    cpu->registers[rd] = shift_immediate(cpu, opcode >> 11, offset, cpu->registers[rs]);
+    cpu_set_nz_flags(cpu, cpu->registers[rd]);
+}
+
+bool check_condition(struct cpu *cpu, WORD instruction)
+{
+    int cond = (instruction >> 28) & 0xF;
+    if (cond == 0xE)
     {
-        cpu->registers[CPSR] |= Z_MASK;
-        cpu->registers[CPSR] &= ~N_MASK;
+        return true;
     }
-    else if (cpu->registers[rd] < 0)
+    return cpu_check_condition_code(cpu, cond);
+}
+
+bool cpu_check_condition_code(struct cpu *cpu, int cond)
+{
+    cpu_materialize_flags(cpu);
+    return (condition_table[cond] >> (cpu->registers[CPSR] >> V_POS)) & 0b1;
+}
+
+// memory holds halfwords and words little endian when the E bit is set and big endian when it is clear
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define HOST_ORDER_32(value, little) ((little) ? __builtin_bswap32(value) : (value))
+#define HOST_ORDER_16(value, little) ((little) ? __builtin_bswap16(value) : (value))
+#else
+#define HOST_ORDER_32(value, little) ((little) ? (value) : __builtin_bswap32(value))
+#define HOST_ORDER_16(value, little) ((little) ? (value) : __builtin_bswap16(value))
+#endif
+
+// an unaligned access that runs off the end of a page or mirror, each byte goes wherever its own address maps
+static WORD read_bytes(struct cpu *cpu, WORD address, int size, bool little)
+{
+    WORD value = 0;
+    for (int i = 0; i < size; i++)
     {
-        cpu->registers[CPSR] |= N_MASK;
-        cpu->registers[CPSR] &= ~Z_MASK;
+        value |= (WORD)read_byte_from_memory(cpu, address + i) << ((little ? i : size - 1 - i) * 8);
     }
+    return value;
 }
 
-bool check_condition(struct cpu *cpu, WORD instruction)
+static void write_bytes(struct cpu *cpu, WORD address, WORD value, int size, bool little)
 {
-    int cond = (instruction >> 28) & 0xF;
-    int32_t updated_cpsr = cpu->registers[update_register(CPSR, cpu)];
-    switch (cond)
+    for (int i = 0; i < size; i++)
     {
-    case 0x0: // EQ
-        return updated_cpsr & Z_MASK;
-    case 0x1: // NE
-        return !(updated_cpsr & Z_MASK);
-    case 0x2: // CS
-        return updated_cpsr & C_MASK;
-    case 0x3: // CC
-        return !(updated_cpsr & C_MASK);
-    case 0x4: // MI
-        return (updated_cpsr & N_MASK);
-    case 0x5: // PL
-        return !(updated_cpsr & N_MASK);
-    case 0x6: // VS
-        return (updated_cpsr & V_MASK);
-    case 0x7: // VC
-        return !(updated_cpsr & V_MASK);
-    case 0x8: // HI
-        return (updated_cpsr & C_MASK) && !(cpu->registers[CPSR] & Z_MASK);
-    case 0x9: // LS
-        return !(updated_cpsr & C_MASK) || (cpu->registers[CPSR] & Z_MASK);
-    case 0xa: // GE
-        return ((updated_cpsr & N_MASK) >> N_POS) == ((cpu->registers[CPSR] & V_MASK) >> V_POS);
-    case 0xb: // LT
-        return ((updated_cpsr & N_MASK) >> N_POS) != ((cpu->registers[CPSR] & V_MASK) >> V_POS);
-    case 0xc: // GT
-        return ((updated_cpsr & Z_MASK) == 0) && ((cpu->registers[CPSR] & N_MASK) >> N_POS) == ((cpu->registers[CPSR] & V_MASK) >> V_POS);
-    case 0xd: // LE
-        return ((updated_cpsr & Z_MASK) != 0) || ((cpu->registers[CPSR] & N_MASK) >> N_POS) != ((cpu->registers[CPSR] & V_MASK) >> V_POS);
-    case 0xe: // AL
-        return true;
+        write_byte_to_memory(cpu, address + i, value >> ((little ? i : size - 1 - i) * 8));
     }
 }
 
-WORD read_word_from_memory(struct cpu *cpu, WORD address)
-{   
-    WORD word = 0;
-    if (address >= VIRTUAL_WRAM_CHIP_START && address <= VIRTUAL_IO_REGISTERS) {
-        address = STACK_START;
+// little is a constant in every caller, so each accessor set below is compiled without the E bit test
+static inline WORD read_word(struct cpu *cpu, WORD address, bool little)
+{
+    WORD value;
+#ifdef CPU_FASTMEM
+    if (cpu->memory_map.fastmem != NULL && fastmem_reaches(address) && fastmem_load_32(cpu->memory_map.fastmem, address, &value))
+    {
+        return HOST_ORDER_32(value, little);
     }
-    for (int i = 0; i < sizeof(word); i++)
+#endif
+    WORD length;
+    BYTE *host = memory_map_span(&cpu->memory_map, address, &length);
+    if (host == NULL)
     {
-        if (cpu->registers[CPSR] & E_MASK)
-        {
-            word <<= 8;
-            WORD ca = address - i + sizeof(word) - 1;
-            word |= cpu->memory[ca];
-        }
-        else
-        {
-            word <<= 8;
-            word |= cpu->memory[address + i];
-        }
+        struct request_data data = {.data_type = word, .data = 0, .request_type = input};
+        cpu_request(cpu, address, &data);
+        return data.data.word;
     }
-    return word;
+    if (length < sizeof(value))
+    {
+        return read_bytes(cpu, address, sizeof(value), little);
+    }
+    memcpy(&value, host, sizeof(value));
+    return HOST_ORDER_32(value, little);
 }
 
-HALF_WORD read_half_word_from_memory(struct cpu *cpu, WORD address)
+static inline HALF_WORD read_half_word(struct cpu *cpu, WORD address, bool little)
 {
-    HALF_WORD half_word = 0;
-    for (int i = 0; i < sizeof(half_word); i++)
+    HALF_WORD value;
+#ifdef CPU_FASTMEM
+    if (cpu->memory_map.fastmem != NULL && fastmem_reaches(address) && fastmem_load_16(cpu->memory_map.fastmem, address, &value))
     {
-        if (cpu->registers[CPSR] & E_MASK)
-        {
-            half_word <<= 8;
-            half_word |= cpu->memory[address - i + sizeof(half_word) - 1];
-        }
-        else
-        {
-            half_word <<= 8;
-            half_word |= cpu->memory[address + i];
-        }
+        return HOST_ORDER_16(value, little);
+    }
+#endif
+    WORD length;
+    BYTE *host = memory_map_span(&cpu->memory_map, address, &length);
+    if (host == NULL)
+    {
+        struct request_data data = {.data_type = half_word, .data = 0, .request_type = input};
+        cpu_request(cpu, address, &data);
+        return data.data.half_word;
     }
-    return half_word;
+    if (length < sizeof(value))
+    {
+        return read_bytes(cpu, address, sizeof(value), little);
+    }
+    memcpy(&value, host, sizeof(value));
+    return HOST_ORDER_16(value, little);
 }
 
-void write_word_to_memory(struct cpu *cpu, WORD address, WORD value)
+static inline void write_word(struct cpu *cpu, WORD address, WORD value, bool little)
 {
-    for (int i = 0; i < sizeof(value); i++)
+    WORD stored = HOST_ORDER_32(value, little);
+#ifdef CPU_FASTMEM
+    if (cpu->memory_map.fastmem != NULL && fastmem_reaches(address) && fastmem_store_32(cpu->memory_map.fastmem, address, stored))
     {
-        if (cpu->registers[CPSR] & E_MASK)
-        {
-            cpu->memory[address + i] = (value >> (i * 8)) & 0xFF;
-        }
-        else
+        block_cache_write(&cpu->block_cache, address, sizeof(value));
+        memory_map_mark_dirty(&cpu->memory_map, address, sizeof(value));
+        return;
+    }
+#endif
+    WORD length;
+    BYTE *host = memory_map_span(&cpu->memory_map, address, &length);
+    if (host == NULL || memory_map_page(&cpu->memory_map, address)->read_only)
+    {
+        struct request_data data = {.data_type = word, .data.word = value, .request_type = output};
+        cpu_request(cpu, address, &data);
+        return;
+    }
+    if (length < sizeof(value))
+    {
+        write_bytes(cpu, address, value, sizeof(value), little);
+        return;
+    }
+    block_cache_write(&cpu->block_cache, address, sizeof(value));
+    memory_map_mark_dirty(&cpu->memory_map, address, sizeof(value));
+    memcpy(host, &stored, sizeof(stored));
+}
+
+static inline void write_half_word(struct cpu *cpu, WORD address, HALF_WORD value, bool little)
+{
+    HALF_WORD stored = HOST_ORDER_16(value, little);
+#ifdef CPU_FASTMEM
+    if (cpu->memory_map.fastmem != NULL && fastmem_reaches(address) && fastmem_store_16(cpu->memory_map.fastmem, address, stored))
+    {
+        block_cache_write(&cpu->block_cache, address, sizeof(value));
+        memory_map_mark_dirty(&cpu->memory_map, address, sizeof(value));
+        return;
+    }
+#endif
+    WORD length;
+    BYTE *host = memory_map_span(&cpu->memory_map, address, &length);
+    if (host == NULL || memory_map_page(&cpu->memory_map, address)->read_only)
+    {
+        struct request_data data = {.data_type = half_word, .data.half_word = value, .request_type = output};
+        cpu_request(cpu, address, &data);
+        return;
+    }
+    if (length < sizeof(value))
+    {
+        write_bytes(cpu, address, value, sizeof(value), little);
+        return;
+    }
+    block_cache_write(&cpu->block_cache, address, sizeof(value));
+    memory_map_mark_dirty(&cpu->memory_map, address, sizeof(value));
+    memcpy(host, &stored, sizeof(stored));
+}
+
+static WORD read_word_little(struct cpu *cpu, WORD address)
+{
+    return read_word(cpu, address, true);
+}
+
+static HALF_WORD read_half_word_little(struct cpu *cpu, WORD address)
+{
+    return read_half_word(cpu, address, true);
+}
+
+static void write_word_little(struct cpu *cpu, WORD address, WORD value)
+{
+    write_word(cpu, address, value, true);
+}
+
+static void write_half_word_little(struct cpu *cpu, WORD address, HALF_WORD value)
+{
+    write_half_word(cpu, address, value, true);
+}
+
+static WORD read_word_big(struct cpu *cpu, WORD address)
+{
+    return read_word(cpu, address, false);
+}
+
+static HALF_WORD read_half_word_big(struct cpu *cpu, WORD address)
+{
+    return read_half_word(cpu, address, false);
+}
+
+static void write_word_big(struct cpu *cpu, WORD address, WORD value)
+{
+    write_word(cpu, address, value, false);
+}
+
+static void write_half_word_big(struct cpu *cpu, WORD address, HALF_WORD value)
+{
+    write_half_word(cpu, address, value, false);
+}
+
+static const struct memory_accessors little_endian_accessors = {
+    .read_word = read_word_little,
+    .read_half_word = read_half_word_little,
+    .write_word = write_word_little,
+    .write_half_word = write_half_word_little,
+};
+
+static const struct memory_accessors big_endian_accessors = {
+    .read_word = read_word_big,
+    .read_half_word = read_half_word_big,
+    .write_word = write_word_big,
+    .write_half_word = write_half_word_big,
+};
+
+void cpu_select_memory_accessors(struct cpu *cpu)
+{
+    cpu->memory_accessors = cpu->registers[CPSR] & E_MASK ? &little_endian_accessors : &big_endian_accessors;
+}
+
+BYTE read_byte_from_memory(struct cpu *cpu, WORD address)
+{
+#ifdef CPU_FASTMEM
+    BYTE value;
+    if (cpu->memory_map.fastmem != NULL && fastmem_reaches(address) && fastmem_load_8(cpu->memory_map.fastmem, address, &value))
+    {
+        return value;
+    }
+#endif
+    BYTE *host = memory_map_pointer(&cpu->memory_map, address);
+    if (host == NULL)
+    {
+        struct request_data data = {.data_type = byte, .data = 0, .request_type = input};
+        cpu_request(cpu, address, &data);
+        return data.data.byte;
+    }
+    return *host;
+}
+
+void write_byte_to_memory(struct cpu *cpu, WORD address, BYTE value)
+{
+#ifdef CPU_FASTMEM
+    if (cpu->memory_map.fastmem != NULL && fastmem_reaches(address) && fastmem_store_8(cpu->memory_map.fastmem, address, value))
+    {
+        block_cache_write(&cpu->block_cache, address, sizeof(value));
+        memory_map_mark_dirty(&cpu->memory_map, address, sizeof(value));
+        return;
+    }
+#endif
+    BYTE *host = memory_map_write_pointer(&cpu->memory_map, address);
+    if (host == NULL)
+    {
+        struct request_data data = {.data_type = byte, .data.byte = value, .request_type = output};
+        cpu_request(cpu, address, &data);
+        return;
+    }
+    block_cache_write(&cpu->block_cache, address, sizeof(value));
+    memory_map_mark_dirty(&cpu->memory_map, address, sizeof(value));
+    *host = value;
+}
+
+// where the banked copy of r8-r14 lives for a mode, registers that are not banked share the user copy
+static int banked_register(enum cpu_mode mode, int reg)
+{
+    switch (mode)
+    {
+    case FIQ:
+        return R8_FIQ + (reg - R8);
+    case SYS:
+        return reg == SP ? SP_SYS : R8_USR + (reg - R8);
+    case SVC:
+        return reg == SP ? SP_SVC : reg == LR ? LR_SVC : R8_USR + (reg - R8);
+    case ABT:
+        return reg == SP ? SP_ABT : reg == LR ? LR_ABT : R8_USR + (reg - R8);
+    case IRQ:
+        return reg == SP ? SP_IRQ : reg == LR ? LR_IRQ : R8_USR + (reg - R8);
+    case UND:
+        return reg == SP ? SP_UND : reg == LR ? LR_UND : R8_USR + (reg - R8);
+    default:
+        return R8_USR + (reg - R8);
+    }
+}
+
+void cpu_switch_mode(struct cpu *cpu, enum cpu_mode mode)
+{
+    enum cpu_mode current = cpu->registers[CPSR] & MODE_MASK;
+    if (current == mode)
+    {
+        return;
+    }
+    for (int reg = R8; reg <= LR; reg++)
+    {
+        int from = banked_register(current, reg);
+        int to = banked_register(mode, reg);
+        if (from != to)
         {
-            cpu->memory[address + i] = (value >> ((sizeof(value) - 1 - i) * 8)) & 0xFF;
+            cpu->registers[from] = cpu->registers[reg];
+            cpu->registers[reg] = cpu->registers[to];
         }
     }
+    cpu->registers[CPSR] = (cpu->registers[CPSR] & ~MODE_MASK) | mode;
+}
+
+void cpu_set_cpsr(struct cpu *cpu, WORD value)
+{
+    cpu_switch_mode(cpu, value & MODE_MASK);
+    cpu->registers[CPSR] = value;
+    cpu->flags.op = FLAGS_CLEAN;
+    cpu_select_memory_accessors(cpu);
 }
 
-void write_half_word_to_memory(struct cpu *cpu, WORD address, HALF_WORD value)
+void cpu_fold_flags(struct cpu *cpu)
 {
-    for (int i = 0; i < sizeof(value); i++)
+    struct lazy_flags *flags = &cpu->flags;
+    WORD cpsr = cpu->registers[CPSR] & ~(N_MASK | Z_MASK);
+    cpsr |= flags->result & N_MASK;
+    if (flags->result == 0)
     {
-        if (cpu->registers[CPSR] & E_MASK)
+        cpsr |= Z_MASK;
+    }
+    if (flags->op == FLAGS_ADD)
+    {
+        cpsr &= ~(C_MASK | V_MASK);
+        if ((((uint64_t)flags->op1 + flags->op2 + flags->carry_in) >> 32) != 0)
         {
-            cpu->memory[address + i] = (value >> (i * 8)) & 0xFF;
+            cpsr |= C_MASK;
         }
-        else
+        // both operands had the same sign and the result does not
+        if ((~(flags->op1 ^ flags->op2) & (flags->op1 ^ flags->result)) & N_MASK)
         {
-            cpu->memory[address + i] = (value >> ((sizeof(value) - 1 - i) * 8)) & 0xFF;
+            cpsr |= V_MASK;
         }
     }
+    cpu->registers[CPSR] = cpsr;
+    flags->op = FLAGS_CLEAN;
 }
 
-int update_register(int r1, struct cpu *cpu) {
-    switch (cpu->registers[CPSR] & MODE_MASK) {
-        case USER: // uses regular registers
-            break;
-        case SYS: // uses SPSR_SYS and SP_SYS
-            switch(r1) {
-                case SP:
-                    r1 = SP_SYS;
-                    break;
-                case CPSR:
-                    r1 = SPSR_SYS;
-                    break;
-            }
-            break;
-        case UND: // uses SPSR_UND and SP_UND, LR_UND
-            switch(r1) {
-                case SP:
-                    r1 = SP_UND;
-                    break;
-                case LR:
-                    r1 = LR_UND;
-                    break;
-                case CPSR:
-                    r1 = SPSR_UND;
-                    break;
-            }
-            break;
-        case SVC: // uses SPSR_SVC and SP_SVC, LR_SVC
-            switch(r1) {
-                case SP:
-                    r1 = SP_SVC;
-                    break;
-                case LR:
-                    r1 = LR_SVC;
-                    break;
-                case CPSR:
-                    r1 = SPSR_SVC;
-                    break;
-            }
-            break;
-        case IRQ: // uses SPSR_IRQ and SP_IRQ, LR_IRQ
-            switch(r1) {
-                case SP:
-                    r1 = SP_IRQ;
-                    break;
-                case LR:
-                    r1 = LR_IRQ;
-                    break;
-                case CPSR:
-                    r1 = SPSR_IRQ;
-                    break;
-            }
-            break;
-        case FIQ: // uses SPSR_FIQ and R8-R12_FIQ, SP_FIQ, LR_FIQ
-            switch(r1) {
-                case R8:
-                    r1 = R8_FIQ;
-                    break;
-                case R9:
-                    r1 = R9_FIQ;
-                    break;
-                case R10:
-                    r1 = R10_FIQ;
-                    break;
-                case R11:
-                    r1 = R11_FIQ;
-                    break;
-                case R12:
-                    r1 = R12_FIQ;
-                    break;
-                case SP:
-                    r1 = SP_FIQ;
-                    break;
-                case LR:
-                    r1 = LR_FIQ;
-                    break;
-                case CPSR:
-                    r1 = SPSR_FIQ;
-                    break;
-            }
-            break;
-        case ABT: // uses SPSR_ABT and SP_ABT, LR_ABT
-            switch(r1) {
-                case SP:
-                    r1 = SP_ABT;
-                    break;
-                case LR:
-                    r1 = LR_ABT;
-                    break;
-                case CPSR:
-                    r1 = SPSR_ABT;
-                    break;
-            }
-            break;
+int cpu_spsr_register(struct cpu *cpu)
+{
+    switch (cpu->registers[CPSR] & MODE_MASK)
+    {
+    case SYS:
+        return SPSR_SYS;
+    case FIQ:
+        return SPSR_FIQ;
+    case SVC:
+        return SPSR_SVC;
+    case ABT:
+        return SPSR_ABT;
+    case IRQ:
+        return SPSR_IRQ;
+    case UND:
+        return SPSR_UND;
+    default:
+        return CPSR;
     }
-    return r1;
-}
\ No newline at end of file
+}
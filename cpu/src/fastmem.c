@@ -0,0 +1,222 @@
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "../include/fastmem.h"
+#include "../include/memory_map.h"
+
+// emitted by FASTMEM_FIXUP at every inlined access, weak so a build without any accesses still links
+extern const struct fastmem_fixup __start_fastmem_fixups[] __attribute__((weak));
+extern const struct fastmem_fixup __stop_fastmem_fixups[] __attribute__((weak));
+
+static struct sigaction previous_handler;
+static bool handler_installed = false;
+
+static void fastmem_fault(int signal, siginfo_t *info, void *context)
+{
+    ucontext_t *ucontext = context;
+    BYTE *rip = (BYTE *)ucontext->uc_mcontext.gregs[REG_RIP];
+    for (const struct fastmem_fixup *fixup = __start_fastmem_fixups; fixup < __stop_fastmem_fixups; fixup++)
+    {
+        if ((BYTE *)&fixup->fault + fixup->fault == rip)
+        {
+            ucontext->uc_mcontext.gregs[REG_RIP] = (greg_t)((BYTE *)&fixup->recover + fixup->recover);
+            return;
+        }
+    }
+    // not a guest access, give it to whoever handled segfaults before
+    if ((previous_handler.sa_flags & SA_SIGINFO) && previous_handler.sa_sigaction != NULL)
+    {
+        previous_handler.sa_sigaction(signal, info, context);
+    }
+    else if (previous_handler.sa_handler == SIG_DFL || previous_handler.sa_handler == SIG_IGN)
+    {
+        // returning faults again, this time into the default action
+        sigaction(SIGSEGV, &previous_handler, NULL);
+    }
+    else
+    {
+        previous_handler.sa_handler(signal);
+    }
+}
+
+static bool install_handler(void)
+{
+    if (handler_installed)
+    {
+        return true;
+    }
+    struct sigaction action = {0};
+    action.sa_sigaction = fastmem_fault;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &previous_handler) != 0)
+    {
+        printf("Error: failed to install the fastmem fault handler\n");
+        return false;
+    }
+    handler_installed = true;
+    return true;
+}
+
+static int create_shared(const char *name, WORD size)
+{
+    int fd = memfd_create(name, MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static WORD round_to_page(WORD size)
+{
+    return (size + MEMORY_PAGE_SIZE - 1) & ~(MEMORY_PAGE_SIZE - 1);
+}
+
+struct fastmem *fastmem_create(WORD stores_size)
+{
+    if (sysconf(_SC_PAGESIZE) > FASTMEM_HOST_PAGE_SIZE || !install_handler())
+    {
+        return NULL;
+    }
+    struct fastmem *fastmem = calloc(1, sizeof(struct fastmem));
+    if (fastmem == NULL)
+    {
+        return NULL;
+    }
+    fastmem->rom_fd = -1;
+    fastmem->stores_size = stores_size;
+    fastmem->stores_fd = create_shared("gba stores", stores_size);
+    if (fastmem->stores_fd < 0)
+    {
+        printf("Error: failed to create the fastmem stores\n");
+        free(fastmem);
+        return NULL;
+    }
+    fastmem->stores = mmap(NULL, stores_size, PROT_READ | PROT_WRITE, MAP_SHARED, fastmem->stores_fd, 0);
+    fastmem->window = mmap(NULL, (size_t)1 << FASTMEM_WINDOW_BITS, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (fastmem->stores == MAP_FAILED || fastmem->window == MAP_FAILED)
+    {
+        printf("Error: failed to reserve the fastmem window\n");
+        fastmem->stores = fastmem->stores == MAP_FAILED ? NULL : fastmem->stores;
+        fastmem->window = fastmem->window == MAP_FAILED ? NULL : fastmem->window;
+        fastmem_destroy(fastmem);
+        return NULL;
+    }
+    return fastmem;
+}
+
+void fastmem_destroy(struct fastmem *fastmem)
+{
+    if (fastmem == NULL)
+    {
+        return;
+    }
+    if (fastmem->window != NULL)
+    {
+        munmap(fastmem->window, (size_t)1 << FASTMEM_WINDOW_BITS);
+    }
+    if (fastmem->stores != NULL)
+    {
+        munmap(fastmem->stores, fastmem->stores_size);
+    }
+    close(fastmem->stores_fd);
+    if (fastmem->rom_fd >= 0)
+    {
+        close(fastmem->rom_fd);
+    }
+    free(fastmem);
+}
+
+bool fastmem_set_rom(struct fastmem *fastmem, BYTE *rom, WORD size, int fd)
+{
+    if (fastmem->rom_fd >= 0)
+    {
+        close(fastmem->rom_fd);
+    }
+    fastmem->rom = rom;
+    fastmem->rom_size = size;
+    // the cartridge's file, the window shares its page cache instead of holding a second copy of the rom
+    fastmem->rom_file = rom != NULL && fd >= 0;
+    if (fastmem->rom_file)
+    {
+        fastmem->rom_fd = dup(fd);
+        return fastmem->rom_fd >= 0;
+    }
+    fastmem->rom_fd = rom == NULL ? -1 : create_shared("gba rom", round_to_page(size));
+    if (fastmem->rom_fd < 0)
+    {
+        return rom == NULL;
+    }
+    // the window gets its own copy, it is mapped read only so it can never drift from the caller's
+    for (WORD done = 0; done < size;)
+    {
+        ssize_t written = pwrite(fastmem->rom_fd, rom + done, size - done, done);
+        if (written <= 0)
+        {
+            printf("Error: failed to copy the rom into the fastmem window\n");
+            close(fastmem->rom_fd);
+            fastmem->rom_fd = -1;
+            return false;
+        }
+        done += written;
+    }
+    return true;
+}
+
+// a file only backs host pages up to its end, touching one past it raises SIGBUS rather than reading zero, so
+// the last page of a file rom is zeros with the file's tail mapped over the front
+static void *map_rom(struct fastmem *fastmem, BYTE *host, WORD offset)
+{
+    WORD file_end = (fastmem->rom_size + FASTMEM_HOST_PAGE_SIZE - 1) & ~(FASTMEM_HOST_PAGE_SIZE - 1);
+    if (!fastmem->rom_file || offset + MEMORY_PAGE_SIZE <= file_end)
+    {
+        return mmap(host, MEMORY_PAGE_SIZE, PROT_READ, MAP_SHARED | MAP_FIXED, fastmem->rom_fd, offset);
+    }
+    if (mmap(host, MEMORY_PAGE_SIZE, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+    {
+        return MAP_FAILED;
+    }
+    return mmap(host, file_end - offset, PROT_READ, MAP_SHARED | MAP_FIXED, fastmem->rom_fd, offset);
+}
+
+static void map_page(struct fastmem *fastmem, struct memory_map *map, WORD page)
+{
+    BYTE *host = fastmem->window + ((size_t)page << MEMORY_PAGE_SHIFT);
+    struct memory_page entry = map->pages[page];
+    void *mapped = MAP_FAILED;
+    // regions smaller than a page mirror inside it, which the host pages cannot show, so they fault like mmio
+    if (entry.base != NULL && entry.mask == MEMORY_PAGE_SIZE - 1)
+    {
+        if (entry.base >= fastmem->stores && entry.base < fastmem->stores + fastmem->stores_size)
+        {
+            mapped = mmap(host, MEMORY_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fastmem->stores_fd, entry.base - fastmem->stores);
+        }
+        else if (fastmem->rom_fd >= 0 && entry.base >= fastmem->rom && entry.base < fastmem->rom + fastmem->rom_size)
+        {
+            mapped = map_rom(fastmem, host, entry.base - fastmem->rom);
+        }
+    }
+    if (mapped == MAP_FAILED)
+    {
+        mmap(host, MEMORY_PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    }
+}
+
+void fastmem_update(struct fastmem *fastmem, struct memory_map *map, WORD first, WORD last)
+{
+    for (WORD page = first; page <= last && page < MEMORY_PAGE_COUNT; page++)
+    {
+        map_page(fastmem, map, page);
+    }
+}
@@ -0,0 +1,507 @@
+#include <string.h>
+#include <sys/mman.h>
+#include "cpu.h"
+#include "jit.h"
+
+// generated code keeps the struct cpu pointer in rbx, everything else is scratch
+enum x86_registers
+{
+    EAX = 0,
+    ECX = 1,
+};
+
+enum x86_conditions
+{
+    X86_E = 0x84,
+    X86_NE = 0x85,
+    X86_LE = 0x8E,
+};
+
+struct jit_emitter
+{
+    BYTE *at;
+    BYTE *exit_sites[BLOCK_MAX_OPS * 2 + 8];
+    int exit_site_count;
+};
+
+#define REGISTER_OFFSET(reg) ((int32_t)(offsetof(struct cpu, registers) + (reg) * sizeof(WORD)))
+
+static void emit8(struct jit_emitter *e, BYTE value)
+{
+    *e->at++ = value;
+}
+
+static void emit32(struct jit_emitter *e, uint32_t value)
+{
+    memcpy(e->at, &value, sizeof(value));
+    e->at += sizeof(value);
+}
+
+static void emit64(struct jit_emitter *e, uint64_t value)
+{
+    memcpy(e->at, &value, sizeof(value));
+    e->at += sizeof(value);
+}
+
+static void patch_rel32(BYTE *site, BYTE *target)
+{
+    int32_t rel = target - (site + sizeof(int32_t));
+    memcpy(site, &rel, sizeof(rel));
+}
+
+// jcc rel32, returns the displacement to patch
+static BYTE *emit_jcc(struct jit_emitter *e, BYTE condition)
+{
+    emit8(e, 0x0F);
+    emit8(e, condition);
+    BYTE *site = e->at;
+    emit32(e, 0);
+    return site;
+}
+
+static BYTE *emit_jmp(struct jit_emitter *e)
+{
+    emit8(e, 0xE9);
+    BYTE *site = e->at;
+    emit32(e, 0);
+    return site;
+}
+
+static void emit_jcc_exit(struct jit_emitter *e, BYTE condition)
+{
+    e->exit_sites[e->exit_site_count++] = emit_jcc(e, condition);
+}
+
+// mov reg, [rbx + registers[arm_reg]]
+static void emit_load_register(struct jit_emitter *e, int reg, int arm_reg)
+{
+    emit8(e, 0x8B);
+    emit8(e, 0x83 | reg << 3);
+    emit32(e, REGISTER_OFFSET(arm_reg));
+}
+
+// mov [rbx + registers[arm_reg]], reg
+static void emit_store_register(struct jit_emitter *e, int reg, int arm_reg)
+{
+    emit8(e, 0x89);
+    emit8(e, 0x83 | reg << 3);
+    emit32(e, REGISTER_OFFSET(arm_reg));
+}
+
+static void emit_advance_pc(struct jit_emitter *e, int bytes)
+{
+    if (bytes == 0)
+    {
+        return;
+    }
+    // add dword [rbx + registers[PC]], imm32, a whole block of ops is past the signed imm8 range
+    emit8(e, 0x81);
+    emit8(e, 0x83);
+    emit32(e, REGISTER_OFFSET(PC));
+    emit32(e, bytes);
+}
+
+static void emit_compare_pc(struct jit_emitter *e, WORD address)
+{
+    // cmp dword [rbx + registers[PC]], imm32
+    emit8(e, 0x81);
+    emit8(e, 0xBB);
+    emit32(e, REGISTER_OFFSET(PC));
+    emit32(e, address);
+}
+
+// handler(cpu, instruction), returns in al for check_condition
+static void emit_call(struct jit_emitter *e, void *function, WORD instruction)
+{
+    emit8(e, 0x48); // mov rdi, rbx
+    emit8(e, 0x89);
+    emit8(e, 0xDF);
+    emit8(e, 0xBE); // mov esi, imm32
+    emit32(e, instruction);
+    emit8(e, 0x48); // mov rax, imm64
+    emit8(e, 0xB8);
+    emit64(e, (uint64_t)(uintptr_t)function);
+    emit8(e, 0xFF); // call rax
+    emit8(e, 0xD0);
+}
+
+// leave when a store hit cached code, the rest of this block may be stale
+static void emit_invalidation_check(struct jit_emitter *e, struct cpu *cpu)
+{
+    emit8(e, 0x48); // mov rax, &block_cache.invalidations
+    emit8(e, 0xB8);
+    emit64(e, (uint64_t)(uintptr_t)&cpu->block_cache.invalidations);
+    emit8(e, 0x48); // mov rax, [rax]
+    emit8(e, 0x8B);
+    emit8(e, 0x00);
+    emit8(e, 0x48); // mov rcx, &jit->invalidations_seen
+    emit8(e, 0xB9);
+    emit64(e, (uint64_t)(uintptr_t)&cpu->jit->invalidations_seen);
+    emit8(e, 0x48); // cmp rax, [rcx]
+    emit8(e, 0x3B);
+    emit8(e, 0x01);
+    emit_jcc_exit(e, X86_NE);
+}
+
+static WORD rotate_right(WORD value, int amount)
+{
+    amount &= 31;
+    return amount == 0 ? value : (value >> amount) | (value << (32 - amount));
+}
+
+// data processing without S on R0-LR, the active register file makes banked registers plain slots,
+// with an operand 2 that is an immediate or an unshifted register
+static bool emit_native_data_processing(struct jit_emitter *e, struct block_op *op)
+{
+    enum
+    {
+        I = 0b1 << 25,
+        S = 0b1 << 20,
+        SHIFT = 0xFF << 4,
+    };
+    enum
+    {
+        AND = 0x0,
+        EOR = 0x1,
+        SUB = 0x2,
+        RSB = 0x3,
+        ADD = 0x4,
+        ORR = 0xC,
+        MOV = 0xD,
+        BIC = 0xE,
+        MVN = 0xF,
+    };
+    WORD instruction = op->instruction;
+    int opcode = (instruction >> 21) & 0xF;
+    if (op->execute.arm != arm_data_processing || op->condition != 0xE || (instruction & S))
+    {
+        return false;
+    }
+    if ((opcode > ADD && opcode < ORR) || op->rd > LR)
+    {
+        return false;
+    }
+    if (opcode != MOV && opcode != MVN && op->rn > LR)
+    {
+        return false;
+    }
+    if (!(instruction & I) && ((instruction & SHIFT) || op->rm > LR))
+    {
+        return false;
+    }
+    if (opcode != MOV && opcode != MVN)
+    {
+        emit_load_register(e, EAX, op->rn);
+    }
+    if (instruction & I)
+    {
+        emit8(e, 0xB9); // mov ecx, imm32
+        emit32(e, rotate_right(instruction & 0xFF, ((instruction >> 8) & 0xF) * 2));
+    }
+    else
+    {
+        emit_load_register(e, ECX, op->rm);
+    }
+    switch (opcode)
+    {
+    case AND:
+        emit8(e, 0x21); // and eax, ecx
+        emit8(e, 0xC8);
+        break;
+    case EOR:
+        emit8(e, 0x31); // xor eax, ecx
+        emit8(e, 0xC8);
+        break;
+    case SUB:
+        emit8(e, 0x29); // sub eax, ecx
+        emit8(e, 0xC8);
+        break;
+    case RSB:
+        emit8(e, 0x29); // sub ecx, eax
+        emit8(e, 0xC1);
+        emit8(e, 0x89); // mov eax, ecx
+        emit8(e, 0xC8);
+        break;
+    case ADD:
+        emit8(e, 0x01); // add eax, ecx
+        emit8(e, 0xC8);
+        break;
+    case ORR:
+        emit8(e, 0x09); // or eax, ecx
+        emit8(e, 0xC8);
+        break;
+    case MOV:
+        emit8(e, 0x89); // mov eax, ecx
+        emit8(e, 0xC8);
+        break;
+    case BIC:
+        emit8(e, 0xF7); // not ecx
+        emit8(e, 0xD1);
+        emit8(e, 0x21); // and eax, ecx
+        emit8(e, 0xC8);
+        break;
+    case MVN:
+        emit8(e, 0xF7); // not ecx
+        emit8(e, 0xD1);
+        emit8(e, 0x89); // mov eax, ecx
+        emit8(e, 0xC8);
+        break;
+    }
+    emit_store_register(e, EAX, op->rd);
+    return true;
+}
+
+static void emit_fallback(struct jit_emitter *e, struct cpu *cpu, struct block_op *op, WORD expected_pc, bool last)
+{
+    BYTE *skip = NULL;
+    BYTE *done = NULL;
+    if (op->condition != 0xE)
+    {
+        emit_call(e, (void *)check_condition, op->instruction);
+        emit8(e, 0x84); // test al, al
+        emit8(e, 0xC0);
+        skip = emit_jcc(e, X86_E);
+    }
+    emit_call(e, (void *)op->execute.arm, op->instruction);
+    if (op->increments_pc)
+    {
+        emit_advance_pc(e, sizeof(WORD));
+    }
+    if (skip != NULL)
+    {
+        done = emit_jmp(e);
+        patch_rel32(skip, e->at);
+        emit_advance_pc(e, sizeof(WORD));
+        patch_rel32(done, e->at);
+    }
+    if (!last)
+    {
+        emit_compare_pc(e, expected_pc);
+        emit_jcc_exit(e, X86_NE);
+        emit_invalidation_check(e, cpu);
+    }
+}
+
+static void link_to(struct jit *jit, BYTE *site, WORD target)
+{
+    struct jit_entry *entry = &jit->blocks[(target >> 2) & (JIT_BLOCK_COUNT - 1)];
+    if (entry->code != NULL && entry->address == target)
+    {
+        // idle loops are only entered from jit_run, so it sees every pass they make
+        if (!entry->idle)
+        {
+            patch_rel32(site, entry->code);
+            jit->chained_links++;
+        }
+    }
+    else if (jit->link_count < JIT_LINK_COUNT)
+    {
+        jit->links[jit->link_count++] = (struct jit_link){.site = site, .target = target};
+    }
+}
+
+// sub dword [&jit->budget], cycles
+static void emit_charge_cycles(struct jit_emitter *e, struct jit *jit, int32_t cycles)
+{
+    emit8(e, 0x48); // mov rax, &jit->budget
+    emit8(e, 0xB8);
+    emit64(e, (uint64_t)(uintptr_t)&jit->budget);
+    emit8(e, 0x81); // sub dword [rax], imm32
+    emit8(e, 0x28);
+    emit32(e, cycles);
+}
+
+// when PC matches target and there are cycles left, jump straight into the target's code
+static void emit_chain(struct jit_emitter *e, struct jit *jit, WORD target)
+{
+    emit_compare_pc(e, target);
+    BYTE *other = emit_jcc(e, X86_NE);
+    emit8(e, 0x48); // mov rax, &jit->budget
+    emit8(e, 0xB8);
+    emit64(e, (uint64_t)(uintptr_t)&jit->budget);
+    emit8(e, 0x83); // cmp dword [rax], 0
+    emit8(e, 0x38);
+    emit8(e, 0x00);
+    emit_jcc_exit(e, X86_LE);
+    BYTE *site = emit_jmp(e);
+    e->exit_sites[e->exit_site_count++] = site; // until the target is compiled
+    link_to(jit, site, target);
+    patch_rel32(other, e->at);
+}
+
+static BYTE *compile_block(struct cpu *cpu, struct block *block)
+{
+    struct jit *jit = cpu->jit;
+    if (jit->arena_used + JIT_MAX_BLOCK_SIZE > JIT_ARENA_SIZE)
+    {
+        jit_flush(jit);
+    }
+    BYTE *code = jit->arena + jit->arena_used;
+    struct jit_emitter e = {.at = code, .exit_site_count = 0};
+    WORD address = block->address;
+    int pending_pc = 0;
+    // the whole block is paid for up front, even when it is left early
+    emit_charge_cycles(&e, jit, block->cycles);
+    for (int i = 0; i < block->op_count; i++)
+    {
+        struct block_op *op = &block->ops[i];
+        address += sizeof(WORD);
+        if (emit_native_data_processing(&e, op))
+        {
+            pending_pc += sizeof(WORD);
+            jit->translated_ops++;
+            continue;
+        }
+        emit_advance_pc(&e, pending_pc);
+        pending_pc = 0;
+        emit_fallback(&e, cpu, op, address, i == block->op_count - 1);
+        jit->fallback_ops++;
+    }
+    emit_advance_pc(&e, pending_pc);
+
+    struct block_op *last = &block->ops[block->op_count - 1];
+    bool chains = !block->idle && (last->execute.arm == arm_branch || (last->increments_pc && block->op_count == BLOCK_MAX_OPS));
+    if (chains)
+    {
+        emit_invalidation_check(&e, cpu);
+    }
+    if (chains && last->execute.arm == arm_branch)
+    {
+        int32_t offset = last->imm;
+        if (offset & (0b1 << 23))
+        {
+            offset |= 0xFF000000;
+        }
+        emit_chain(&e, jit, address - sizeof(WORD) + 8 + offset * 4);
+        if (last->condition != 0xE)
+        {
+            emit_chain(&e, jit, address);
+        }
+    }
+    else if (chains)
+    {
+        emit_chain(&e, jit, address);
+    }
+
+    BYTE *exit = e.at;
+    emit8(&e, 0x5B); // pop rbx
+    emit8(&e, 0xC3); // ret
+    for (int i = 0; i < e.exit_site_count; i++)
+    {
+        BYTE *site = e.exit_sites[i];
+        int32_t rel;
+        memcpy(&rel, site, sizeof(rel));
+        if (rel == 0)
+        {
+            patch_rel32(site, exit);
+        }
+    }
+    jit->arena_used += e.at - code;
+    jit->compiled_blocks++;
+    return code;
+}
+
+struct jit *jit_create(void)
+{
+    struct jit *jit = calloc(1, sizeof(struct jit));
+    if (jit == NULL)
+    {
+        return NULL;
+    }
+    jit->arena = mmap(NULL, JIT_ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->arena == MAP_FAILED)
+    {
+        printf("Error: failed to map the jit arena, falling back to the interpreter\n");
+        free(jit);
+        return NULL;
+    }
+    struct jit_emitter e = {.at = jit->arena};
+    emit8(&e, 0x53); // push rbx
+    emit8(&e, 0x48); // mov rbx, rdi
+    emit8(&e, 0x89);
+    emit8(&e, 0xFB);
+    emit8(&e, 0xFF); // jmp rsi
+    emit8(&e, 0xE6);
+    jit->enter = (void (*)(struct cpu *, BYTE *))jit->arena;
+    jit->code_start = e.at - jit->arena;
+    jit_flush(jit);
+    return jit;
+}
+
+void jit_destroy(struct jit *jit)
+{
+    if (jit == NULL)
+    {
+        return;
+    }
+    munmap(jit->arena, JIT_ARENA_SIZE);
+    free(jit);
+}
+
+void jit_flush(struct jit *jit)
+{
+    jit->arena_used = jit->code_start;
+    jit->link_count = 0;
+    for (int i = 0; i < JIT_BLOCK_COUNT; i++)
+    {
+        jit->blocks[i].code = NULL;
+    }
+}
+
+struct jit_entry *jit_lookup(struct cpu *cpu, WORD address)
+{
+    struct jit *jit = cpu->jit;
+    if (jit->invalidations_seen != cpu->block_cache.invalidations)
+    {
+        jit_flush(jit);
+        jit->invalidations_seen = cpu->block_cache.invalidations;
+    }
+    struct jit_entry *entry = &jit->blocks[(address >> 2) & (JIT_BLOCK_COUNT - 1)];
+    if (entry->code != NULL && entry->address == address)
+    {
+        return entry;
+    }
+    struct block *block = block_cache_lookup(cpu, address, false);
+    BYTE *code = compile_block(cpu, block);
+    entry->address = address;
+    entry->code = code;
+    entry->idle = block->idle;
+    // blocks compiled earlier that branch here can now jump directly
+    for (int i = 0; i < jit->link_count;)
+    {
+        if (jit->links[i].target == address)
+        {
+            if (!entry->idle)
+            {
+                patch_rel32(jit->links[i].site, code);
+                jit->chained_links++;
+            }
+            jit->links[i] = jit->links[--jit->link_count];
+        }
+        else
+        {
+            i++;
+        }
+    }
+    return entry;
+}
+
+int32_t jit_run(struct cpu *cpu, int32_t cycles)
+{
+    struct jit *jit = cpu->jit;
+    jit->budget = cycles;
+    while (jit->budget > 0 && cpu->isOn && !(cpu->registers[CPSR] & T_MASK))
+    {
+        struct jit_entry *entry = jit_lookup(cpu, cpu->registers[PC]);
+        WORD address = entry->address;
+        jit->enter(cpu, entry->code);
+        if (entry->idle && cpu->registers[PC] == address && jit->budget > 0)
+        {
+            // the budget always ends at the next event, nothing the loop looks at changes before then
+            cpu->block_cache.idle_skips++;
+            cpu->block_cache.idle_cycles_skipped += jit->budget;
+            jit->budget = 0;
+        }
+    }
+    return cycles - jit->budget;
+}
@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../include/memory_map.h"
+#ifdef CPU_FASTMEM
+#include "../include/fastmem.h"
+#endif
+
+static WORD store_size(WORD size)
+{
+    return (size + MEMORY_STORE_ALIGN - 1) & ~(MEMORY_STORE_ALIGN - 1);
+}
+
+// a region at least a page long is split into whole pages, a smaller one repeats inside its page
+static struct memory_page region_page(BYTE *store, WORD size, WORD address)
+{
+    if (size < MEMORY_PAGE_SIZE)
+    {
+        return (struct memory_page){.base = store, .mask = size - 1};
+    }
+    WORD offset = address & (size - 1) & ~(MEMORY_PAGE_SIZE - 1);
+    return (struct memory_page){.base = store + offset, .mask = MEMORY_PAGE_SIZE - 1};
+}
+
+static struct memory_page default_page(struct memory_map *map, WORD page)
+{
+    WORD address = page << MEMORY_PAGE_SHIFT;
+    WORD region = address >> REGION_SHIFT;
+    switch (region)
+    {
+    case REGION_BIOS:
+        if (address < BIOS_SIZE)
+        {
+            return region_page(map->bios, BIOS_SIZE, address);
+        }
+        break;
+    case REGION_EWRAM:
+        return region_page(map->ewram, EWRAM_SIZE, address);
+    case REGION_IWRAM:
+        return region_page(map->iwram, IWRAM_SIZE, address);
+    case REGION_IO:
+        // plain registers until a request channel claims them
+        if ((address & ((1 << REGION_SHIFT) - 1)) < IO_SIZE)
+        {
+            return region_page(map->io, IO_SIZE, address);
+        }
+        break;
+    case REGION_PALETTE:
+        return region_page(map->palette, PALETTE_SIZE, address);
+    case REGION_VRAM:
+    {
+        WORD offset = address & (VRAM_MIRROR_SIZE - 1);
+        if (offset >= VRAM_SIZE)
+        {
+            offset -= VRAM_MIRROR_SIZE - VRAM_SIZE;
+        }
+        return (struct memory_page){.base = map->vram + offset, .mask = MEMORY_PAGE_SIZE - 1};
+    }
+    case REGION_OAM:
+        return region_page(map->oam, OAM_SIZE, address);
+    case REGION_SRAM:
+    case REGION_SRAM_MIRROR:
+        return region_page(map->sram, SRAM_SIZE, address);
+    default:
+        if (region >= REGION_ROM_WAIT_STATE_1 && region <= REGION_ROM_WAIT_STATE_3_END && map->rom != NULL)
+        {
+            // the three wait state windows are each a mirror of the same 32 MB
+            WORD offset = address & (ROM_MAX_SIZE - 1);
+            if (offset < map->rom_size)
+            {
+                return (struct memory_page){.base = map->rom + offset, .mask = MEMORY_PAGE_SIZE - 1, .read_only = true};
+            }
+        }
+        break;
+    }
+    return (struct memory_page){.base = NULL, .mask = 0};
+}
+
+// keeps the fastmem window showing the same pages as the table
+static void update_fastmem(struct memory_map *map, WORD first, WORD last)
+{
+#ifdef CPU_FASTMEM
+    if (map->fastmem != NULL)
+    {
+        fastmem_update(map->fastmem, map, first, last);
+    }
+#endif
+}
+
+void memory_map_init(struct memory_map *map)
+{
+    WORD total = store_size(BIOS_SIZE) + store_size(EWRAM_SIZE) + store_size(IWRAM_SIZE) + store_size(IO_SIZE) +
+                 store_size(PALETTE_SIZE) + store_size(VRAM_SIZE) + store_size(OAM_SIZE) + store_size(SRAM_SIZE);
+    map->fastmem = NULL;
+#ifdef CPU_FASTMEM
+    map->fastmem = fastmem_create(total);
+    map->stores = map->fastmem != NULL ? map->fastmem->stores : NULL;
+#endif
+    if (map->fastmem == NULL)
+    {
+        map->stores = calloc(total, sizeof(BYTE));
+    }
+    if (map->stores == NULL)
+    {
+        printf("Error: failed to allocate %u bytes of gba memory\n", total);
+        exit(-1);
+    }
+    map->bios = map->stores;
+    map->ewram = map->bios + store_size(BIOS_SIZE);
+    map->iwram = map->ewram + store_size(EWRAM_SIZE);
+    map->io = map->iwram + store_size(IWRAM_SIZE);
+    map->palette = map->io + store_size(IO_SIZE);
+    map->vram = map->palette + store_size(PALETTE_SIZE);
+    map->oam = map->vram + store_size(VRAM_SIZE);
+    map->sram = map->oam + store_size(OAM_SIZE);
+    map->rom = NULL;
+    map->rom_size = 0;
+    for (WORD page = 0; page < MEMORY_PAGE_COUNT; page++)
+    {
+        map->pages[page] = default_page(map, page);
+    }
+    update_fastmem(map, 0, MEMORY_PAGE_COUNT - 1);
+    // nothing has been drawn from the display memory yet
+    memset(map->dirty, 0xFF, sizeof(map->dirty));
+}
+
+void memory_map_free(struct memory_map *map)
+{
+#ifdef CPU_FASTMEM
+    if (map->fastmem != NULL)
+    {
+        fastmem_destroy(map->fastmem);
+        map->fastmem = NULL;
+        map->stores = NULL;
+        return;
+    }
+#endif
+    free(map->stores);
+    map->stores = NULL;
+}
+
+void memory_map_set_rom(struct memory_map *map, BYTE *rom, WORD size, int fd)
+{
+    if (size > ROM_MAX_SIZE)
+    {
+        printf("Error: rom is 0x%x bytes, only the first 0x%x are mapped\n", size, ROM_MAX_SIZE);
+        size = ROM_MAX_SIZE;
+    }
+    map->rom = rom;
+    map->rom_size = size;
+#ifdef CPU_FASTMEM
+    if (map->fastmem != NULL && !fastmem_set_rom(map->fastmem, rom, size, fd))
+    {
+        printf("Error: rom is only reachable through the page table\n");
+    }
+#endif
+    WORD first = (REGION_ROM_WAIT_STATE_1 << REGION_SHIFT) >> MEMORY_PAGE_SHIFT;
+    WORD last = ((REGION_ROM_WAIT_STATE_3_END + 1) << REGION_SHIFT) >> MEMORY_PAGE_SHIFT;
+    for (WORD page = first; page < last; page++)
+    {
+        map->pages[page] = default_page(map, page);
+    }
+    update_fastmem(map, first, last - 1);
+}
+
+void memory_map_set_mmio(struct memory_map *map, WORD address, WORD size, bool mmio)
+{
+    if (size == 0)
+    {
+        return;
+    }
+    WORD first = (address & MEMORY_ADDRESS_MASK) >> MEMORY_PAGE_SHIFT;
+    WORD last = ((address + size - 1) & MEMORY_ADDRESS_MASK) >> MEMORY_PAGE_SHIFT;
+    for (WORD page = first; page <= last && page < MEMORY_PAGE_COUNT; page++)
+    {
+        map->pages[page] = mmio ? (struct memory_page){.base = NULL, .mask = 0} : default_page(map, page);
+    }
+    update_fastmem(map, first, last);
+}
+
+BYTE *memory_map_backing_pointer(struct memory_map *map, WORD address, bool write)
+{
+    struct memory_page page = default_page(map, (address & MEMORY_ADDRESS_MASK) >> MEMORY_PAGE_SHIFT);
+    if (page.base == NULL || (write && page.read_only))
+    {
+        return NULL;
+    }
+    return page.base + (address & page.mask);
+}
+
+static WORD dirty_shift(int region)
+{
+    switch (region)
+    {
+    case DIRTY_PALETTE:
+        return PALETTE_DIRTY_SHIFT;
+    case DIRTY_VRAM:
+        return VRAM_DIRTY_SHIFT;
+    default:
+        return OAM_DIRTY_SHIFT;
+    }
+}
+
+// calls visit for every granule of the range once per mirror it appears in, a range covering a whole mirror
+// is cut down to one
+static bool visit_dirty(struct memory_map *map, WORD address, WORD size, bool (*visit)(uint64_t *word, uint64_t bit))
+{
+    int region;
+    WORD bit;
+    if (size == 0 || !memory_map_dirty_bit(address, &region, &bit))
+    {
+        return false;
+    }
+    WORD granule = 1 << dirty_shift(region);
+    WORD mirror = region == DIRTY_VRAM ? VRAM_MIRROR_SIZE : PALETTE_SIZE;
+    WORD end = address + (size < mirror ? size : mirror);
+    bool found = false;
+    for (WORD at = address & ~(granule - 1); at < end; at += granule)
+    {
+        int at_region;
+        if (!memory_map_dirty_bit(at, &at_region, &bit) || at_region != region)
+        {
+            break;
+        }
+        found |= visit(&map->dirty[region][bit / 64], (uint64_t)1 << (bit % 64));
+    }
+    return found;
+}
+
+static bool set_dirty(uint64_t *word, uint64_t bit)
+{
+    *word |= bit;
+    return true;
+}
+
+static bool test_dirty(uint64_t *word, uint64_t bit)
+{
+    return (*word & bit) != 0;
+}
+
+static bool clear_dirty(uint64_t *word, uint64_t bit)
+{
+    *word &= ~bit;
+    return true;
+}
+
+void memory_map_mark_dirty_range(struct memory_map *map, WORD address, WORD size)
+{
+    visit_dirty(map, address, size, set_dirty);
+}
+
+bool memory_map_is_dirty(struct memory_map *map, WORD address, WORD size)
+{
+    return visit_dirty(map, address, size, test_dirty);
+}
+
+void memory_map_clear_dirty(struct memory_map *map, WORD address, WORD size)
+{
+    visit_dirty(map, address, size, clear_dirty);
+}
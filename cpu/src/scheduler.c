@@ -0,0 +1,98 @@
+#include "cpu.h"
+
+void scheduler_init(struct scheduler *scheduler)
+{
+    scheduler->event_count = 0;
+}
+
+static void swap_events(struct scheduler *scheduler, int a, int b)
+{
+    struct scheduler_event event = scheduler->events[a];
+    scheduler->events[a] = scheduler->events[b];
+    scheduler->events[b] = event;
+}
+
+static void sift_up(struct scheduler *scheduler, int i)
+{
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (scheduler->events[parent].when <= scheduler->events[i].when)
+        {
+            return;
+        }
+        swap_events(scheduler, parent, i);
+        i = parent;
+    }
+}
+
+static void sift_down(struct scheduler *scheduler, int i)
+{
+    while (true)
+    {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < scheduler->event_count && scheduler->events[left].when < scheduler->events[smallest].when)
+        {
+            smallest = left;
+        }
+        if (right < scheduler->event_count && scheduler->events[right].when < scheduler->events[smallest].when)
+        {
+            smallest = right;
+        }
+        if (smallest == i)
+        {
+            return;
+        }
+        swap_events(scheduler, smallest, i);
+        i = smallest;
+    }
+}
+
+static void remove_first_event(struct scheduler *scheduler)
+{
+    scheduler->events[0] = scheduler->events[--scheduler->event_count];
+    sift_down(scheduler, 0);
+}
+
+bool scheduler_add(struct scheduler *scheduler, uint64_t when, enum scheduler_event_type type, scheduler_callback callback, void *data)
+{
+    if (scheduler->event_count == SCHEDULER_MAX_EVENTS)
+    {
+        printf("Error: scheduler is full, dropping event %d\n", type);
+        return false;
+    }
+    int i = scheduler->event_count++;
+    scheduler->events[i] = (struct scheduler_event){.when = when, .type = type, .callback = callback, .data = data};
+    sift_up(scheduler, i);
+    return true;
+}
+
+void scheduler_cancel(struct scheduler *scheduler, enum scheduler_event_type type)
+{
+    int kept = 0;
+    for (int i = 0; i < scheduler->event_count; i++)
+    {
+        if (scheduler->events[i].type != type)
+        {
+            scheduler->events[kept++] = scheduler->events[i];
+        }
+    }
+    scheduler->event_count = kept;
+    for (int i = kept / 2 - 1; i >= 0; i--)
+    {
+        sift_down(scheduler, i);
+    }
+}
+
+void scheduler_run_due(struct cpu *cpu)
+{
+    struct scheduler *scheduler = &cpu->scheduler;
+    while (scheduler->event_count > 0 && scheduler->events[0].when <= cpu->cycles)
+    {
+        struct scheduler_event event = scheduler->events[0];
+        remove_first_event(scheduler);
+        event.callback(cpu, event.data, event.when);
+    }
+}
@@ -1,10 +1,771 @@
+#include <string.h>
 #include "../include/syscall.h"
 
+enum cpu_set_control
+{
+    CPU_SET_COUNT = 0x1FFFFF,
+    CPU_SET_FILL = 0b1 << 24,
+    CPU_SET_WORDS = 0b1 << 26,
+    CPU_FAST_SET_BLOCK = 8, // words, CpuFastSet always moves whole blocks of 8
+};
+
+enum compression_header
+{
+    COMPRESSION_DATA_SIZE = 0xF, // huffman bits per symbol, diff filter unit size
+    COMPRESSION_TYPE = 0xF << 4,
+    COMPRESSION_SIZE_POS = 8,
+};
+
+enum compression_formats
+{
+    LZ77_MIN_LENGTH = 3,
+    LZ77_MIN_DISTANCE = 1,
+    RL_COMPRESSED = 0b1 << 7,
+    RL_LENGTH = 0x7F,
+    RL_MIN_RUN = 3,
+    RL_MIN_COPY = 1,
+    HUFF_OFFSET = 0x3F,
+    HUFF_NODE_1_DATA = 0b1 << 6,
+    HUFF_NODE_0_DATA = 0b1 << 7,
+    BIT_UNPACK_OFFSET = 0x7FFFFFFF,
+    BIT_UNPACK_ZERO_DATA = 0b1u << 31,
+};
+
+enum affine_set
+{
+    SINE_TABLE_SIZE = 256, // the bios only uses the top 8 bits of an angle
+    SINE_SHIFT = 14, // 1.14 fixed point
+    COSINE_OFFSET = SINE_TABLE_SIZE / 4,
+    AFFINE_BATCH = 32, // inputs loaded into the columns below before any maths runs
+    BG_AFFINE_SOURCE_SIZE = 20,
+    BG_AFFINE_DESTINATION_SIZE = 16,
+    OBJ_AFFINE_SOURCE_SIZE = 8,
+};
+
+// the bios's own table, sin(i * 2 pi / 256) * 0x4000 truncated toward zero, which rounding the same sum misses by
+// one in nearly half the entries
+static const int16_t sine_table[SINE_TABLE_SIZE] = {
+    0x0000, 0x0192, 0x0323, 0x04B5, 0x0645, 0x07D5, 0x0964, 0x0AF1,
+    0x0C7C, 0x0E05, 0x0F8C, 0x1111, 0x1294, 0x1413, 0x158F, 0x1708,
+    0x187D, 0x19EF, 0x1B5D, 0x1CC6, 0x1E2B, 0x1F8B, 0x20E7, 0x223D,
+    0x238E, 0x24DA, 0x261F, 0x275F, 0x2899, 0x29CD, 0x2AFA, 0x2C21,
+    0x2D41, 0x2E5A, 0x2F6B, 0x3076, 0x3179, 0x3274, 0x3367, 0x3453,
+    0x3536, 0x3612, 0x36E5, 0x37AF, 0x3871, 0x392A, 0x39DA, 0x3A82,
+    0x3B20, 0x3BB6, 0x3C42, 0x3CC5, 0x3D3E, 0x3DAE, 0x3E14, 0x3E71,
+    0x3EC5, 0x3F0E, 0x3F4E, 0x3F84, 0x3FB1, 0x3FD3, 0x3FEC, 0x3FFB,
+    0x4000, 0x3FFB, 0x3FEC, 0x3FD3, 0x3FB1, 0x3F84, 0x3F4E, 0x3F0E,
+    0x3EC5, 0x3E71, 0x3E14, 0x3DAE, 0x3D3E, 0x3CC5, 0x3C42, 0x3BB6,
+    0x3B20, 0x3A82, 0x39DA, 0x392A, 0x3871, 0x37AF, 0x36E5, 0x3612,
+    0x3536, 0x3453, 0x3367, 0x3274, 0x3179, 0x3076, 0x2F6B, 0x2E5A,
+    0x2D41, 0x2C21, 0x2AFA, 0x29CD, 0x2899, 0x275F, 0x261F, 0x24DA,
+    0x238E, 0x223D, 0x20E7, 0x1F8B, 0x1E2B, 0x1CC6, 0x1B5D, 0x19EF,
+    0x187D, 0x1708, 0x158F, 0x1413, 0x1294, 0x1111, 0x0F8C, 0x0E05,
+    0x0C7C, 0x0AF1, 0x0964, 0x07D5, 0x0645, 0x04B5, 0x0323, 0x0192,
+    0x0000, -0x0192, -0x0323, -0x04B5, -0x0645, -0x07D5, -0x0964, -0x0AF1,
+    -0x0C7C, -0x0E05, -0x0F8C, -0x1111, -0x1294, -0x1413, -0x158F, -0x1708,
+    -0x187D, -0x19EF, -0x1B5D, -0x1CC6, -0x1E2B, -0x1F8B, -0x20E7, -0x223D,
+    -0x238E, -0x24DA, -0x261F, -0x275F, -0x2899, -0x29CD, -0x2AFA, -0x2C21,
+    -0x2D41, -0x2E5A, -0x2F6B, -0x3076, -0x3179, -0x3274, -0x3367, -0x3453,
+    -0x3536, -0x3612, -0x36E5, -0x37AF, -0x3871, -0x392A, -0x39DA, -0x3A82,
+    -0x3B20, -0x3BB6, -0x3C42, -0x3CC5, -0x3D3E, -0x3DAE, -0x3E14, -0x3E71,
+    -0x3EC5, -0x3F0E, -0x3F4E, -0x3F84, -0x3FB1, -0x3FD3, -0x3FEC, -0x3FFB,
+    -0x4000, -0x3FFB, -0x3FEC, -0x3FD3, -0x3FB1, -0x3F84, -0x3F4E, -0x3F0E,
+    -0x3EC5, -0x3E71, -0x3E14, -0x3DAE, -0x3D3E, -0x3CC5, -0x3C42, -0x3BB6,
+    -0x3B20, -0x3A82, -0x39DA, -0x392A, -0x3871, -0x37AF, -0x36E5, -0x3612,
+    -0x3536, -0x3453, -0x3367, -0x3274, -0x3179, -0x3076, -0x2F6B, -0x2E5A,
+    -0x2D41, -0x2C21, -0x2AFA, -0x29CD, -0x2899, -0x275F, -0x261F, -0x24DA,
+    -0x238E, -0x223D, -0x20E7, -0x1F8B, -0x1E2B, -0x1CC6, -0x1B5D, -0x19EF,
+    -0x187D, -0x1708, -0x158F, -0x1413, -0x1294, -0x1111, -0x0F8C, -0x0E05,
+    -0x0C7C, -0x0AF1, -0x0964, -0x07D5, -0x0645, -0x04B5, -0x0323, -0x0192,
+};
+
+// one batch of affine inputs and results, a column per field so every step of the maths is one plain loop
+struct affine_batch
+{
+    int32_t scale_x[AFFINE_BATCH];
+    int32_t scale_y[AFFINE_BATCH];
+    int32_t sine[AFFINE_BATCH];
+    int32_t cosine[AFFINE_BATCH];
+    int32_t pa[AFFINE_BATCH];
+    int32_t pb[AFFINE_BATCH];
+    int32_t pc[AFFINE_BATCH];
+    int32_t pd[AFFINE_BATCH];
+};
+
+static const gba_syscall hle_syscalls[GBA_SYSCALL_COUNT] = {
+    [DIV] = gba_div,
+    [DIV_ARM] = gba_div_arm,
+    [SQRT] = gba_sqrt,
+    [ARCTAN] = gba_arctan,
+    [ARCTAN2] = gba_arctan2,
+    [CPU_SET] = gba_cpu_set,
+    [CPU_FAST_SET] = gba_cpu_fast_set,
+    [GET_BIOS_CHECKSUM] = gba_get_bios_checksum,
+    [BG_AFFINE_SET] = gba_bg_affine_set,
+    [OBJ_AFFINE_SET] = gba_obj_affine_set,
+    [BIT_UNPACK] = gba_bit_unpack,
+    [LZ77_UNCOMPRESSED_READ_NORMAL_WRITE_8_BIT] = gba_lz77_write_8_bit,
+    [LZ77_UNCOMPRESSED_READ_NORMAL_WRITE_16_BIT] = gba_lz77_write_16_bit,
+    [HUFF_UNCOMPRESSED_READ_NORMAL] = gba_huffman,
+    [RL_UNCOMPRESSED_READ_NORMAL_WRITE_8_BIT] = gba_rl_write_8_bit,
+    [RL_UNCOMPRESSED_READ_NORMAL_WRITE_16_BIT] = gba_rl_write_16_bit,
+    [DIFF_8_BIT_UNFILTERRED_WRITE_8_BIT] = gba_diff_8_bit_write_8_bit,
+    [DIFF_8_BIT_UNFILTERRED_WRITE_16_BIT] = gba_diff_8_bit_write_16_bit,
+    [DIFF_16_BIT_UNFILTERRED] = gba_diff_16_bit,
+};
+
+bool cpu_hle_syscall(struct cpu *cpu, int number)
+{
+    if (!cpu->hle_syscalls || number >= GBA_SYSCALL_COUNT || hle_syscalls[number] == NULL)
+    {
+        return false;
+    }
+    if ((cpu->lle_syscalls >> number) & 0b1)
+    {
+        return false;
+    }
+    hle_syscalls[number](cpu);
+    return true;
+}
+
+void cpu_set_syscall_lle(struct cpu *cpu, enum gba_syscall_number number, bool lle)
+{
+    if (lle)
+    {
+        cpu->lle_syscalls |= (uint64_t)0b1 << number;
+    }
+    else
+    {
+        cpu->lle_syscalls &= ~((uint64_t)0b1 << number);
+    }
+}
+
 void gba_div(struct cpu *cpu)
 {
     int num = cpu->registers[R0];
     int denom = cpu->registers[R1];
+    // same result as the bios.s version
+    if (denom == 0)
+    {
+        cpu->registers[R0] = -1;
+        cpu->registers[R1] = -1;
+        cpu->registers[R3] = -1;
+        return;
+    }
+    // 0x80000000 / -1 traps on the host, the bios wraps back to 0x80000000
+    if (denom == -1)
+    {
+        WORD quotient = 0 - (WORD)num;
+        cpu->registers[R0] = quotient;
+        cpu->registers[R1] = 0;
+        cpu->registers[R3] = (int32_t)quotient < 0 ? 0 - quotient : quotient;
+        return;
+    }
     cpu->registers[R0] = num / denom;
     cpu->registers[R1] = num % denom;
     cpu->registers[R3] = abs(num / denom);
-}
\ No newline at end of file
+}
+
+void gba_div_arm(struct cpu *cpu)
+{
+    WORD num = cpu->registers[R1];
+    cpu->registers[R1] = cpu->registers[R0];
+    cpu->registers[R0] = num;
+    gba_div(cpu);
+}
+
+void gba_sqrt(struct cpu *cpu)
+{
+    WORD value = cpu->registers[R0];
+    WORD root = 0;
+    for (WORD bit = 0b1 << 30; bit != 0; bit >>= 2)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+    }
+    cpu->registers[R0] = root;
+}
+
+// the bios series for tan in 1.1.14 fixed point, the result is in 0x10000 per turn
+static int32_t arctan(int32_t tan)
+{
+    int32_t a = -((tan * tan) >> 14);
+    int32_t b = ((Order_15 * a) >> 14) + Order_13;
+    b = ((b * a) >> 14) + Order_11;
+    b = ((b * a) >> 14) + Order_9;
+    b = ((b * a) >> 14) + Order_7;
+    b = ((b * a) >> 14) + Order_5;
+    b = ((b * a) >> 14) + Order_3;
+    b = ((b * a) >> 14) + Order_1;
+    return (tan * b) >> 16;
+}
+
+void gba_arctan(struct cpu *cpu)
+{
+    cpu->registers[R0] = arctan((int16_t)cpu->registers[R0]);
+}
+
+void gba_arctan2(struct cpu *cpu)
+{
+    int32_t x = (int16_t)cpu->registers[R0];
+    int32_t y = (int16_t)cpu->registers[R1];
+    WORD angle = 0;
+    if (y == 0)
+    {
+        angle = x >= 0 ? 0 : 0x8000;
+    }
+    else if (x == 0)
+    {
+        angle = y >= 0 ? 0x4000 : 0xC000;
+    }
+    else if (y >= 0)
+    {
+        if (x >= 0 && x >= y)
+        {
+            angle = arctan((y << 14) / x);
+        }
+        else if (x < 0 && -x >= y)
+        {
+            angle = arctan((y << 14) / x) + 0x8000;
+        }
+        else
+        {
+            angle = 0x4000 - arctan((x << 14) / y);
+        }
+    }
+    else
+    {
+        if (x <= 0 && -x > -y)
+        {
+            angle = arctan((y << 14) / x) + 0x8000;
+        }
+        else if (x > 0 && x >= -y)
+        {
+            angle = arctan((y << 14) / x) + 0x10000;
+        }
+        else
+        {
+            angle = 0xC000 - arctan((x << 14) / y);
+        }
+    }
+    cpu->registers[R0] = angle & 0xFFFF;
+}
+
+// one halfword or word at a time, the memory map sends it to the request channels when there is no memory
+static WORD read_unit(struct cpu *cpu, WORD address, WORD unit)
+{
+    return unit == sizeof(WORD) ? read_word_from_memory(cpu, address) : read_half_word_from_memory(cpu, address);
+}
+
+static void write_unit(struct cpu *cpu, WORD address, WORD unit, WORD value)
+{
+    if (unit == sizeof(WORD))
+    {
+        write_word_to_memory(cpu, address, value);
+    }
+    else
+    {
+        write_half_word_to_memory(cpu, address, value);
+    }
+}
+
+// repeats the stored bytes of the unit at the start of to, so the byte order in memory stays whatever the E bit made it
+static void fill_span(BYTE *to, WORD unit, WORD bytes)
+{
+    if (memcmp(to, to + 1, unit - 1) == 0)
+    {
+        memset(to, to[0], bytes);
+        return;
+    }
+    for (WORD done = unit; done < bytes; done *= 2)
+    {
+        memcpy(to + done, to, done < bytes - done ? done : bytes - done);
+    }
+}
+
+// copies or fills count units, every run that stays inside one page of memory on both sides is moved as one
+// block, only the units at mmio pages go one at a time
+static void bulk_set(struct cpu *cpu, WORD source, WORD destination, WORD count, WORD unit, bool fill)
+{
+    struct memory_map *map = &cpu->memory_map;
+    WORD i = 0;
+    while (i < count)
+    {
+        WORD to_length;
+        WORD from_length;
+        WORD from_address = fill ? source : source + i * unit;
+        BYTE *to = memory_map_span(map, destination + i * unit, &to_length);
+        if (memory_map_page(map, destination + i * unit)->read_only)
+        {
+            to = NULL;
+        }
+        BYTE *from = memory_map_span(map, from_address, &from_length);
+        WORD units = to_length / unit;
+        if (!fill && from_length / unit < units)
+        {
+            units = from_length / unit;
+        }
+        if (count - i < units)
+        {
+            units = count - i;
+        }
+        WORD bytes = units * unit;
+        // the bios copies forwards, so a destination just after its source repeats the start like a fill would
+        bool overlaps = !fill && to > from && to < from + bytes;
+        if (to == NULL || from == NULL || from_length < unit || units == 0 || overlaps)
+        {
+            write_unit(cpu, destination + i * unit, unit, read_unit(cpu, from_address, unit));
+            i++;
+            continue;
+        }
+        block_cache_invalidate(&cpu->block_cache, destination + i * unit, bytes);
+        memory_map_mark_dirty_range(map, destination + i * unit, bytes);
+        if (fill)
+        {
+            memmove(to, from, unit);
+            fill_span(to, unit, bytes);
+        }
+        else
+        {
+            memmove(to, from, bytes);
+        }
+        i += units;
+    }
+}
+
+void gba_cpu_set(struct cpu *cpu)
+{
+    WORD control = cpu->registers[R2];
+    WORD unit = control & CPU_SET_WORDS ? sizeof(WORD) : sizeof(HALF_WORD);
+    WORD source = cpu->registers[R0] & ~(unit - 1);
+    WORD destination = cpu->registers[R1] & ~(unit - 1);
+    bulk_set(cpu, source, destination, control & CPU_SET_COUNT, unit, control & CPU_SET_FILL);
+}
+
+void gba_cpu_fast_set(struct cpu *cpu)
+{
+    WORD control = cpu->registers[R2];
+    WORD count = ((control & CPU_SET_COUNT) + CPU_FAST_SET_BLOCK - 1) & ~(CPU_FAST_SET_BLOCK - 1);
+    WORD source = cpu->registers[R0] & ~(sizeof(WORD) - 1);
+    WORD destination = cpu->registers[R1] & ~(sizeof(WORD) - 1);
+    bulk_set(cpu, source, destination, count, sizeof(WORD), control & CPU_SET_FILL);
+}
+
+void gba_get_bios_checksum(struct cpu *cpu)
+{
+    cpu->registers[R0] = GBA_BIOS_CHECKSUM;
+}
+
+// compressed streams are read a byte at a time in memory order
+struct decode_input
+{
+    struct cpu *cpu;
+    WORD address;
+};
+
+// the vram variants only ever store halfwords, so a byte waits in pending until its pair is decoded
+struct decode_output
+{
+    struct cpu *cpu;
+    WORD address;
+    bool half_words;
+    HALF_WORD pending;
+    int pending_bytes;
+};
+
+static BYTE input_byte(struct decode_input *in)
+{
+    WORD address = in->address++;
+    BYTE *host = memory_map_pointer(&in->cpu->memory_map, address);
+    if (host != NULL)
+    {
+        return *host;
+    }
+    struct request_data data = {.data_type = byte, .data = 0, .request_type = input};
+    cpu_request(in->cpu, address, &data);
+    return data.data.byte;
+}
+
+static WORD input_word(struct decode_input *in)
+{
+    WORD value = 0;
+    for (int i = 0; i < sizeof(WORD); i++)
+    {
+        value |= (WORD)input_byte(in) << (i * 8);
+    }
+    return value;
+}
+
+// reads the header and invalidates and marks dirty the whole destination up front, returns the decompressed size
+static WORD start_decode(struct decode_input *in, struct decode_output *out, WORD *header)
+{
+    *header = input_word(in);
+    WORD size = *header >> COMPRESSION_SIZE_POS;
+    block_cache_invalidate(&out->cpu->block_cache, out->address, size);
+    memory_map_mark_dirty_range(&out->cpu->memory_map, out->address, size);
+    return size;
+}
+
+static void store(struct cpu *cpu, WORD address, WORD value, WORD size)
+{
+    BYTE *host = memory_map_write_pointer(&cpu->memory_map, address);
+    if (host != NULL)
+    {
+        for (int i = 0; i < size; i++)
+        {
+            host[i] = (value >> (i * 8)) & 0xFF;
+        }
+        return;
+    }
+    struct request_data data = {.request_type = output};
+    if (size == sizeof(HALF_WORD))
+    {
+        data.data_type = half_word;
+        data.data.half_word = value;
+    }
+    else
+    {
+        data.data_type = byte;
+        data.data.byte = value;
+    }
+    cpu_request(cpu, address, &data);
+}
+
+static void output_byte(struct decode_output *out, BYTE value)
+{
+    if (!out->half_words)
+    {
+        store(out->cpu, out->address++, value, sizeof(BYTE));
+        return;
+    }
+    out->pending |= value << (out->pending_bytes * 8);
+    if (++out->pending_bytes == sizeof(HALF_WORD))
+    {
+        store(out->cpu, out->address, out->pending, sizeof(HALF_WORD));
+        out->address += sizeof(HALF_WORD);
+        out->pending = 0;
+        out->pending_bytes = 0;
+    }
+}
+
+// a byte already decoded, distance bytes back from the next one
+static BYTE output_history(struct decode_output *out, WORD distance)
+{
+    if (distance <= out->pending_bytes)
+    {
+        return (out->pending >> ((out->pending_bytes - distance) * 8)) & 0xFF;
+    }
+    WORD address = out->address + out->pending_bytes - distance;
+    BYTE *host = memory_map_pointer(&out->cpu->memory_map, address);
+    if (host != NULL)
+    {
+        return *host;
+    }
+    struct request_data data = {.data_type = byte, .data = 0, .request_type = input};
+    cpu_request(out->cpu, address, &data);
+    return data.data.byte;
+}
+
+static void lz77(struct cpu *cpu, bool half_words)
+{
+    struct decode_input in = {.cpu = cpu, .address = cpu->registers[R0]};
+    struct decode_output out = {.cpu = cpu, .address = cpu->registers[R1], .half_words = half_words};
+    WORD header;
+    WORD remaining = start_decode(&in, &out, &header);
+    while (remaining > 0)
+    {
+        BYTE flags = input_byte(&in);
+        for (int i = 0; i < 8 && remaining > 0; i++, flags <<= 1)
+        {
+            if (!(flags & 0x80))
+            {
+                output_byte(&out, input_byte(&in));
+                remaining--;
+                continue;
+            }
+            BYTE first = input_byte(&in);
+            BYTE second = input_byte(&in);
+            WORD length = (first >> 4) + LZ77_MIN_LENGTH;
+            WORD distance = (((first & 0xF) << 8) | second) + LZ77_MIN_DISTANCE;
+            for (; length > 0 && remaining > 0; length--, remaining--)
+            {
+                output_byte(&out, output_history(&out, distance));
+            }
+        }
+    }
+}
+
+void gba_lz77_write_8_bit(struct cpu *cpu)
+{
+    lz77(cpu, false);
+}
+
+void gba_lz77_write_16_bit(struct cpu *cpu)
+{
+    lz77(cpu, true);
+}
+
+static void run_length(struct cpu *cpu, bool half_words)
+{
+    struct decode_input in = {.cpu = cpu, .address = cpu->registers[R0]};
+    struct decode_output out = {.cpu = cpu, .address = cpu->registers[R1], .half_words = half_words};
+    WORD header;
+    WORD remaining = start_decode(&in, &out, &header);
+    while (remaining > 0)
+    {
+        BYTE flag = input_byte(&in);
+        if (flag & RL_COMPRESSED)
+        {
+            WORD length = (flag & RL_LENGTH) + RL_MIN_RUN;
+            BYTE value = input_byte(&in);
+            for (; length > 0 && remaining > 0; length--, remaining--)
+            {
+                output_byte(&out, value);
+            }
+        }
+        else
+        {
+            WORD length = (flag & RL_LENGTH) + RL_MIN_COPY;
+            for (; length > 0 && remaining > 0; length--, remaining--)
+            {
+                output_byte(&out, input_byte(&in));
+            }
+        }
+    }
+}
+
+void gba_rl_write_8_bit(struct cpu *cpu)
+{
+    run_length(cpu, false);
+}
+
+void gba_rl_write_16_bit(struct cpu *cpu)
+{
+    run_length(cpu, true);
+}
+
+void gba_huffman(struct cpu *cpu)
+{
+    struct decode_input in = {.cpu = cpu, .address = cpu->registers[R0]};
+    struct decode_output out = {.cpu = cpu, .address = cpu->registers[R1], .half_words = true};
+    WORD header;
+    WORD remaining = start_decode(&in, &out, &header);
+    WORD symbol_bits = header & COMPRESSION_DATA_SIZE;
+    WORD tree = in.address;
+    WORD root = tree + 1;
+    // the bitstream starts after the tree table, which is (size + 1) * 2 bytes long
+    in.address = tree + (input_byte(&in) + 1) * 2;
+    WORD word = 0;
+    int word_bits = 0;
+    WORD node_address = root;
+    struct decode_input node_in = {.cpu = cpu};
+    while (remaining > 0)
+    {
+        WORD bits = input_word(&in);
+        for (int i = 31; i >= 0 && remaining > 0; i--)
+        {
+            node_in.address = node_address;
+            BYTE node = input_byte(&node_in);
+            WORD bit = (bits >> i) & 0b1;
+            WORD child = (node_address & ~0b1) + (node & HUFF_OFFSET) * 2 + 2 + bit;
+            if (!(node & (bit ? HUFF_NODE_1_DATA : HUFF_NODE_0_DATA)))
+            {
+                node_address = child;
+                continue;
+            }
+            node_in.address = child;
+            word |= (WORD)input_byte(&node_in) << word_bits;
+            word_bits += symbol_bits;
+            node_address = root;
+            if (word_bits == 32)
+            {
+                for (int b = 0; b < sizeof(WORD) && remaining > 0; b++, remaining--)
+                {
+                    output_byte(&out, (word >> (b * 8)) & 0xFF);
+                }
+                word = 0;
+                word_bits = 0;
+            }
+        }
+    }
+}
+
+static void diff_unfilter(struct cpu *cpu, WORD unit, bool half_words)
+{
+    struct decode_input in = {.cpu = cpu, .address = cpu->registers[R0]};
+    struct decode_output out = {.cpu = cpu, .address = cpu->registers[R1], .half_words = half_words};
+    WORD header;
+    WORD remaining = start_decode(&in, &out, &header);
+    WORD value = 0;
+    for (; remaining >= unit; remaining -= unit)
+    {
+        WORD delta = input_byte(&in);
+        if (unit == sizeof(HALF_WORD))
+        {
+            delta |= input_byte(&in) << 8;
+        }
+        value += delta;
+        for (int b = 0; b < unit; b++)
+        {
+            output_byte(&out, (value >> (b * 8)) & 0xFF);
+        }
+    }
+}
+
+void gba_diff_8_bit_write_8_bit(struct cpu *cpu)
+{
+    diff_unfilter(cpu, sizeof(BYTE), false);
+}
+
+void gba_diff_8_bit_write_16_bit(struct cpu *cpu)
+{
+    diff_unfilter(cpu, sizeof(BYTE), true);
+}
+
+void gba_diff_16_bit(struct cpu *cpu)
+{
+    diff_unfilter(cpu, sizeof(HALF_WORD), true);
+}
+
+void gba_bit_unpack(struct cpu *cpu)
+{
+    struct decode_input info = {.cpu = cpu, .address = cpu->registers[R2]};
+    WORD length = input_byte(&info);
+    length |= input_byte(&info) << 8;
+    WORD source_bits = input_byte(&info);
+    WORD destination_bits = input_byte(&info);
+    WORD offset = input_word(&info);
+    bool zero_data = offset & BIT_UNPACK_ZERO_DATA;
+    offset &= BIT_UNPACK_OFFSET;
+    if (source_bits == 0 || destination_bits == 0 || source_bits > 8 || destination_bits > 32)
+    {
+        printf("Error: BitUnPack widths %d to %d are not supported\n", source_bits, destination_bits);
+        return;
+    }
+    struct decode_input in = {.cpu = cpu, .address = cpu->registers[R0]};
+    WORD destination = cpu->registers[R1];
+    WORD unpacked = (length * 8 / source_bits) * destination_bits / 8;
+    block_cache_invalidate(&cpu->block_cache, destination, unpacked);
+    memory_map_mark_dirty_range(&cpu->memory_map, destination, unpacked);
+    uint64_t word = 0;
+    int word_bits = 0;
+    WORD source_mask = (0b1 << source_bits) - 1;
+    for (WORD i = 0; i < length; i++)
+    {
+        BYTE packed = input_byte(&in);
+        for (int bit = 0; bit < 8; bit += source_bits)
+        {
+            WORD value = (packed >> bit) & source_mask;
+            if (value != 0 || zero_data)
+            {
+                value += offset;
+            }
+            word |= (uint64_t)value << word_bits;
+            word_bits += destination_bits;
+            if (word_bits >= 32)
+            {
+                // bit unpack writes whole words
+                store(cpu, destination, word & 0xFFFF, sizeof(HALF_WORD));
+                store(cpu, destination + sizeof(HALF_WORD), (word >> 16) & 0xFFFF, sizeof(HALF_WORD));
+                destination += sizeof(WORD);
+                word = 0;
+                word_bits = 0;
+            }
+        }
+    }
+}
+
+static void affine_load_angle(struct affine_batch *batch, int i, HALF_WORD angle)
+{
+    BYTE index = angle >> 8;
+    batch->sine[i] = sine_table[index];
+    batch->cosine[i] = sine_table[(BYTE)(index + COSINE_OFFSET)];
+}
+
+static void affine_matrices(struct affine_batch *batch, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        batch->pa[i] = (batch->scale_x[i] * batch->cosine[i]) >> SINE_SHIFT;
+        batch->pb[i] = (-batch->scale_x[i] * batch->sine[i]) >> SINE_SHIFT;
+        batch->pc[i] = (batch->scale_y[i] * batch->sine[i]) >> SINE_SHIFT;
+        batch->pd[i] = (batch->scale_y[i] * batch->cosine[i]) >> SINE_SHIFT;
+    }
+}
+
+void gba_bg_affine_set(struct cpu *cpu)
+{
+    struct affine_batch batch;
+    int32_t origin_x[AFFINE_BATCH];
+    int32_t origin_y[AFFINE_BATCH];
+    int32_t display_x[AFFINE_BATCH];
+    int32_t display_y[AFFINE_BATCH];
+    WORD source = cpu->registers[R0];
+    WORD destination = cpu->registers[R1];
+    for (WORD left = cpu->registers[R2]; left > 0;)
+    {
+        int count = left < AFFINE_BATCH ? left : AFFINE_BATCH;
+        for (int i = 0; i < count; i++, source += BG_AFFINE_SOURCE_SIZE)
+        {
+            origin_x[i] = read_unit(cpu, source, sizeof(WORD));
+            origin_y[i] = read_unit(cpu, source + 4, sizeof(WORD));
+            display_x[i] = (int16_t)read_unit(cpu, source + 8, sizeof(HALF_WORD));
+            display_y[i] = (int16_t)read_unit(cpu, source + 10, sizeof(HALF_WORD));
+            batch.scale_x[i] = (int16_t)read_unit(cpu, source + 12, sizeof(HALF_WORD));
+            batch.scale_y[i] = (int16_t)read_unit(cpu, source + 14, sizeof(HALF_WORD));
+            affine_load_angle(&batch, i, read_unit(cpu, source + 16, sizeof(HALF_WORD)));
+        }
+        affine_matrices(&batch, count);
+        // where the screen's top left corner lands in the background, moved so the display centre sits on the origin
+        for (int i = 0; i < count; i++)
+        {
+            origin_x[i] -= batch.pa[i] * display_x[i] + batch.pb[i] * display_y[i];
+            origin_y[i] -= batch.pc[i] * display_x[i] + batch.pd[i] * display_y[i];
+        }
+        for (int i = 0; i < count; i++, destination += BG_AFFINE_DESTINATION_SIZE)
+        {
+            write_unit(cpu, destination, sizeof(HALF_WORD), batch.pa[i] & 0xFFFF);
+            write_unit(cpu, destination + 2, sizeof(HALF_WORD), batch.pb[i] & 0xFFFF);
+            write_unit(cpu, destination + 4, sizeof(HALF_WORD), batch.pc[i] & 0xFFFF);
+            write_unit(cpu, destination + 6, sizeof(HALF_WORD), batch.pd[i] & 0xFFFF);
+            write_unit(cpu, destination + 8, sizeof(WORD), origin_x[i]);
+            write_unit(cpu, destination + 12, sizeof(WORD), origin_y[i]);
+        }
+        left -= count;
+    }
+}
+
+// r3 is the distance between the four outputs, 2 to pack them together or 8 to write straight into oam
+void gba_obj_affine_set(struct cpu *cpu)
+{
+    struct affine_batch batch;
+    WORD source = cpu->registers[R0];
+    WORD destination = cpu->registers[R1];
+    WORD stride = cpu->registers[R3];
+    for (WORD left = cpu->registers[R2]; left > 0;)
+    {
+        int count = left < AFFINE_BATCH ? left : AFFINE_BATCH;
+        for (int i = 0; i < count; i++, source += OBJ_AFFINE_SOURCE_SIZE)
+        {
+            batch.scale_x[i] = (int16_t)read_unit(cpu, source, sizeof(HALF_WORD));
+            batch.scale_y[i] = (int16_t)read_unit(cpu, source + 2, sizeof(HALF_WORD));
+            affine_load_angle(&batch, i, read_unit(cpu, source + 4, sizeof(HALF_WORD)));
+        }
+        affine_matrices(&batch, count);
+        for (int i = 0; i < count; i++, destination += stride * 4)
+        {
+            write_unit(cpu, destination, sizeof(HALF_WORD), batch.pa[i] & 0xFFFF);
+            write_unit(cpu, destination + stride, sizeof(HALF_WORD), batch.pb[i] & 0xFFFF);
+            write_unit(cpu, destination + stride * 2, sizeof(HALF_WORD), batch.pc[i] & 0xFFFF);
+            write_unit(cpu, destination + stride * 3, sizeof(HALF_WORD), batch.pd[i] & 0xFFFF);
+        }
+        left -= count;
+    }
+}
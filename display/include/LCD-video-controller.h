@@ -1,8 +1,12 @@
+#pragma once
+#include <stdbool.h>
 #include "data_sizes.h"
 #include "requests.h"
 
+// halfword index of each register from 0x04000000
 enum LCD_video_controller_registers {
     LCD_IO_DISPLAY_CONTROL = 0,
+    LCD_IO_GREEN_SWAP,
     LCD_IO_STATUS,
     LCD_VCOUNT,
     // 4 background layers
@@ -12,9 +16,12 @@ enum LCD_video_controller_registers {
     // 2 background layer (BG2 + 3), 2 offsets per layer, 2 registers per offset, 2 scaling and 2 rotation per layer
     LCD_IO_BG_ROTATATION_AND_SCALING = LCD_IO_BG_SCROLLING + (4 * 2), 
     LCD_IO_WINDOW_FEATURES = LCD_IO_BG_ROTATATION_AND_SCALING + (2 * ((2 * 2) + 2 + 2)),
-    LCD_IO_MOSAIC_FUNCTION,
-    LCD_IO_COLOR_SPECIAL_EFFECTS,
-    LCD_VIDEO_CONTROLLER_REGISTERS_COUNT
+    // 2 horizontal and 2 vertical window edges, inside and outside
+    LCD_IO_MOSAIC_FUNCTION = LCD_IO_WINDOW_FEATURES + 6,
+    // mosaic is followed by an unused register
+    LCD_IO_COLOR_SPECIAL_EFFECTS = LCD_IO_MOSAIC_FUNCTION + 2,
+    // control, alpha and brightness
+    LCD_VIDEO_CONTROLLER_REGISTERS_COUNT = LCD_IO_COLOR_SPECIAL_EFFECTS + 3
 };
 
 enum LCD_IO_DISPLAY_REGISTER_BIT_POSITIONS {
@@ -109,10 +116,37 @@ enum LCD_IO_BG_ROTATATION_AND_SCALING_REGISTER_BIT_FIELDS {
     SCALING = 0b111111111
 };
 
+enum LCD_BG_SCREEN_ENTRY_BIT_FIELDS {
+    TILE_NUMBER = 0b1111111111,
+    HORIZONTAL_FLIP = 0b1 << 10,
+    VERTICAL_FLIP = 0b1 << 11,
+    TILE_PALETTE_POS = 12,
+};
+
+enum LCD_sizes {
+    LCD_WIDTH = 240,
+    LCD_HEIGHT = 160,
+    LCD_TILE_SIZE = 8,
+    LCD_CHARACTER_BLOCK_SIZE = 16 * KB,
+    LCD_SCREEN_BLOCK_SIZE = 2 * KB, // 32 by 32 screen entries
+    LCD_SCREEN_BLOCK_TILES = 32,
+    LCD_BG_COUNT = 4,
+};
+
 struct LCD_video_controller {
     HALF_WORD registers[LCD_VIDEO_CONTROLLER_REGISTERS_COUNT];
+    // the line being drawn, each pixel is a palette entry copied as it is stored so it stays little endian
+    HALF_WORD scanline[LCD_WIDTH];
 };
 
 void LCD_video_controller_init(struct LCD_video_controller* lcd);
 
-void LCD_video_controller_process_request(struct LCD_video_controller* lcd, struct request_data* request);
\ No newline at end of file
+// request addresses are relative to 0x04000000, which is where the channel has to be mapped
+void LCD_video_controller_process_request(struct LCD_video_controller* lcd, struct request_data* request);
+
+// copies the registers out of io memory, the hardware takes them once per line as well
+void LCD_video_controller_latch(struct LCD_video_controller* lcd, const BYTE* io);
+
+// draws the text backgrounds of modes 0 and 1 into scanline over the backdrop, mode 2 only gets the backdrop,
+// false in the bitmap modes
+bool LCD_video_controller_render_scanline(struct LCD_video_controller* lcd, int line, const BYTE* vram, const BYTE* palette);
\ No newline at end of file
@@ -1,6 +1,25 @@
 #pragma once
 
 #include <SDL.h>
+#include <stdbool.h>
+
+enum display_sizes
+{
+    SCREEN_WIDTH = 240,
+    SCREEN_HEIGHT = 160,
+    BITMAP_FRAME_SIZE = 0xA000, // where the second frame of modes 4 and 5 starts in vram
+    MODE_5_WIDTH = 160,
+    MODE_5_HEIGHT = 128,
+    BGR555_COLORS = 1 << 15,
+};
+
+// the parts of the display control register the bitmap modes look at
+enum display_control
+{
+    DISPLAY_CONTROL_MODE = 0b111,
+    DISPLAY_CONTROL_FRAME = 0b1 << 4,
+    DISPLAY_CONTROL_FORCED_BLANK = 0b1 << 7,
+};
 
 struct display
 {
@@ -8,6 +27,10 @@ struct display
     int height;
     SDL_Window *window;
     SDL_Renderer *renderer;
+    SDL_Texture *texture; // streaming, the framebuffer is uploaded to it once per update
+    uint32_t *framebuffer; // SCREEN_WIDTH * SCREEN_HEIGHT RGBA8888 pixels the emulator draws into
+    uint32_t *colors; // BGR555_COLORS entries, the RGBA8888 each guest color is shown as
+    bool color_correction; // colors imitate the gba's darker, washed out lcd
     int last_update;
     int num_of_layers;
 };
@@ -16,10 +39,19 @@ void init_display(struct display *display, int width, int height, const char* ti
 
 void destory_display(struct display *display);
 
+// uploads the framebuffer and scales it to the window
 void update_display(struct display *display, int current_tick);
 
+// rebuilds the color table, off shows the guest colors as they are stored
+void display_set_color_correction(struct display *display, bool color_correction);
+
+// converts count little endian BGR555 colors to RGBA8888, a whole line at a time
+void display_convert_line(struct display *display, const uint8_t *line, uint32_t *out, int count);
+
+// color is BGR555 like the palette, pixels outside the screen are dropped
 void set_pixel(struct display *display, int x, int y, int32_t color);
 
-void get_pixel(struct display *display, int x, int y, int32_t *color);
+// draws modes 3 to 5 straight from the guest's vram and palette, false for the tile modes which it leaves alone
+bool display_compose_bitmap(struct display *display, uint16_t control, const uint8_t *vram, const uint8_t *palette);
 
 SDL_HitTestResult MyCallback(SDL_Window* win, const SDL_Point* area, void* data);
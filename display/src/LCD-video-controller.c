@@ -1,23 +1,197 @@
+#include <string.h>
 #include "LCD-video-controller.h"
 
+enum LCD_background_sizes {
+    BG_VRAM_SIZE = 64 * KB, // tiles and maps past this are object memory, backgrounds read them as 0
+    TEXT_BG_SIDE = 256,
+    TILE_BYTES_4BPP = 32,
+    TILE_BYTES_8BPP = 64,
+    PALETTE_BANK_COLORS = 16,
+};
+
 void LCD_video_controller_init(struct LCD_video_controller* lcd)
 {
     for (int i = 0; i < LCD_VIDEO_CONTROLLER_REGISTERS_COUNT; i++)
     {
         lcd->registers[i] = 0;
     }
+    memset(lcd->scanline, 0, sizeof(lcd->scanline));
 }
 
 void LCD_video_controller_process_request(struct LCD_video_controller* lcd, struct request_data* request)
 {
-    int reg = request->address - 0x4000000;
-    reg /= sizeof(HALF_WORD);
+    int reg = request->address / sizeof(HALF_WORD);
+    if (request->data_type == word)
+    {
+        reg &= ~0b1;
+    }
+    if (reg < 0 || reg >= LCD_VIDEO_CONTROLLER_REGISTERS_COUNT)
+    {
+        return;
+    }
+    HALF_WORD *value = &lcd->registers[reg];
+    int byte_shift = (request->address & 0b1) * 8;
     switch (request->request_type)
     {
         case input: // return value
+            switch (request->data_type)
+            {
+                case word:
+                    request->data.word = value[0] | (reg + 1 < LCD_VIDEO_CONTROLLER_REGISTERS_COUNT ? (WORD)value[1] << 16 : 0);
+                    break;
+                case half_word:
+                    request->data.half_word = *value;
+                    break;
+                case byte:
+                    request->data.byte = (*value >> byte_shift) & 0xFF;
+                    break;
+            }
             break;
         case output: // set value
-            lcd->registers[reg] = request->data.half_word;
+            switch (request->data_type)
+            {
+                case word:
+                    value[0] = request->data.word & 0xFFFF;
+                    if (reg + 1 < LCD_VIDEO_CONTROLLER_REGISTERS_COUNT)
+                    {
+                        value[1] = request->data.word >> 16;
+                    }
+                    break;
+                case half_word:
+                    *value = request->data.half_word;
+                    break;
+                case byte:
+                    *value = (*value & ~(0xFF << byte_shift)) | (request->data.byte << byte_shift);
+                    break;
+            }
             break;
     }
-}
\ No newline at end of file
+}
+
+void LCD_video_controller_latch(struct LCD_video_controller* lcd, const BYTE* io)
+{
+    for (int i = 0; i < LCD_VIDEO_CONTROLLER_REGISTERS_COUNT; i++)
+    {
+        lcd->registers[i] = io[i * 2] | (io[i * 2 + 1] << 8);
+    }
+}
+
+// spreads the 8 nibbles of a 4 bpp tile row into the 8 bytes of a word, a whole row at a time instead of a
+// shift and mask per pixel, pixel i ends up in byte i
+static uint64_t unpack_4bpp_row(const BYTE* row)
+{
+    uint64_t pixels = row[0] | (row[1] << 8) | (row[2] << 16) | ((WORD)row[3] << 24);
+    pixels = (pixels | (pixels << 16)) & 0x0000FFFF0000FFFFull;
+    pixels = (pixels | (pixels << 8)) & 0x00FF00FF00FF00FFull;
+    pixels = (pixels | (pixels << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return pixels;
+}
+
+static uint64_t load_8bpp_row(const BYTE* row)
+{
+    uint64_t pixels = 0;
+    for (int i = 0; i < LCD_TILE_SIZE; i++)
+    {
+        pixels |= (uint64_t)row[i] << (i * 8);
+    }
+    return pixels;
+}
+
+static void render_text_background(struct LCD_video_controller* lcd, int bg, int line, const BYTE* vram, const BYTE* palette)
+{
+    HALF_WORD control = lcd->registers[LCD_IO_BG_CONTROL + bg];
+    WORD character_base = ((control & CHARACTER_BASE_BLOCK) >> CHARACTER_BASE_BLOCK_POS) * LCD_CHARACTER_BLOCK_SIZE;
+    WORD screen_base = ((control & SCREEN_BASE_BLOCK) >> SCREEN_BASE_BLOCK_POS) * LCD_SCREEN_BLOCK_SIZE;
+    bool colors_256 = control & PALLETS;
+    int size = (control & SCREEN_SIZE) >> SCREEN_SIZE_POS;
+    int width = size & 0b01 ? TEXT_BG_SIDE * 2 : TEXT_BG_SIDE;
+    int height = size & 0b10 ? TEXT_BG_SIDE * 2 : TEXT_BG_SIDE;
+    int x_scroll = lcd->registers[LCD_IO_BG_SCROLLING + bg * 2] & SCROLL;
+    int y = (line + (lcd->registers[LCD_IO_BG_SCROLLING + bg * 2 + 1] & SCROLL)) & (height - 1);
+    // the screen blocks of a wide map sit side by side, the lower half of a tall one comes after all of them
+    WORD row_base = screen_base + (y / TEXT_BG_SIDE) * (width / TEXT_BG_SIDE) * LCD_SCREEN_BLOCK_SIZE +
+                    ((y % TEXT_BG_SIDE) / LCD_TILE_SIZE) * LCD_SCREEN_BLOCK_TILES * sizeof(HALF_WORD);
+    for (int x = -(x_scroll % LCD_TILE_SIZE); x < LCD_WIDTH; x += LCD_TILE_SIZE)
+    {
+        int map_x = (x + x_scroll) & (width - 1);
+        WORD entry_address = row_base + (map_x / TEXT_BG_SIDE) * LCD_SCREEN_BLOCK_SIZE + ((map_x % TEXT_BG_SIDE) / LCD_TILE_SIZE) * sizeof(HALF_WORD);
+        if (entry_address >= BG_VRAM_SIZE)
+        {
+            continue;
+        }
+        HALF_WORD entry = vram[entry_address] | (vram[entry_address + 1] << 8);
+        int tile_y = entry & VERTICAL_FLIP ? LCD_TILE_SIZE - 1 - (y % LCD_TILE_SIZE) : y % LCD_TILE_SIZE;
+        uint64_t pixels;
+        int palette_base = 0;
+        if (colors_256)
+        {
+            WORD address = character_base + (entry & TILE_NUMBER) * TILE_BYTES_8BPP + tile_y * LCD_TILE_SIZE;
+            if (address >= BG_VRAM_SIZE)
+            {
+                continue;
+            }
+            pixels = load_8bpp_row(vram + address);
+        }
+        else
+        {
+            WORD address = character_base + (entry & TILE_NUMBER) * TILE_BYTES_4BPP + tile_y * LCD_TILE_SIZE / 2;
+            if (address >= BG_VRAM_SIZE)
+            {
+                continue;
+            }
+            pixels = unpack_4bpp_row(vram + address);
+            palette_base = (entry >> TILE_PALETTE_POS) * PALETTE_BANK_COLORS;
+        }
+        if (pixels == 0)
+        {
+            continue;
+        }
+        for (int i = 0; i < LCD_TILE_SIZE; i++)
+        {
+            int screen_x = x + i;
+            int column = entry & HORIZONTAL_FLIP ? LCD_TILE_SIZE - 1 - i : i;
+            BYTE index = (pixels >> (column * 8)) & 0xFF;
+            // colour 0 of every palette is transparent
+            if (index != 0 && screen_x >= 0 && screen_x < LCD_WIDTH)
+            {
+                memcpy(&lcd->scanline[screen_x], palette + (palette_base + index) * sizeof(HALF_WORD), sizeof(HALF_WORD));
+            }
+        }
+    }
+}
+
+bool LCD_video_controller_render_scanline(struct LCD_video_controller* lcd, int line, const BYTE* vram, const BYTE* palette)
+{
+    HALF_WORD control = lcd->registers[LCD_IO_DISPLAY_CONTROL];
+    int mode = (control & BG_MODE) >> BG_MODE_POS;
+    // modes 3-5 are bitmaps composed once per frame
+    if (mode > 2)
+    {
+        return false;
+    }
+    if (control & FORCED_BLANK)
+    {
+        // white, stored little endian like the palette
+        memset(lcd->scanline, 0xFF, sizeof(lcd->scanline));
+        return true;
+    }
+    for (int x = 0; x < LCD_WIDTH; x++)
+    {
+        memcpy(&lcd->scanline[x], palette, sizeof(HALF_WORD));
+    }
+    // mode 1 has two text backgrounds and an affine one, mode 2 only affine ones, which leave the backdrop for now
+    int text_backgrounds = mode == 0 ? LCD_BG_COUNT : mode == 1 ? 2 : 0;
+    // back to front, a lower numbered background wins a priority tie
+    for (int priority = 3; priority >= 0; priority--)
+    {
+        for (int bg = text_backgrounds - 1; bg >= 0; bg--)
+        {
+            bool enabled = control & (SCREEN_DISPLAY_BG0 << bg);
+            if (enabled && (lcd->registers[LCD_IO_BG_CONTROL + bg] & BG_PRIORITY) >> BG_PRIORITY_POS == priority)
+            {
+                render_text_background(lcd, bg, line, vram, palette);
+            }
+        }
+    }
+    return true;
+}
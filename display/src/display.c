@@ -1,4 +1,9 @@
+#include <math.h>
 #include "display.h"
+#if defined(__SSE2__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <emmintrin.h>
+#define DISPLAY_SSE2
+#endif
 
 void init_display(struct display *display, int width, int height, const char *title)
 {   
@@ -16,42 +21,187 @@ void init_display(struct display *display, int width, int height, const char *ti
         SDL_Log("Renderer could not be created! SDL_Error: %s\n", SDL_GetError());
         exit(1);
     }
+    display->texture = SDL_CreateTexture(display->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (display->texture == NULL)
+    {
+        SDL_Log("Texture could not be created! SDL_Error: %s\n", SDL_GetError());
+        exit(1);
+    }
+    display->framebuffer = calloc(SCREEN_WIDTH * SCREEN_HEIGHT, sizeof(uint32_t));
+    if (display->framebuffer == NULL)
+    {
+        SDL_Log("Framebuffer could not be allocated\n");
+        exit(1);
+    }
+    display->colors = malloc(BGR555_COLORS * sizeof(uint32_t));
+    if (display->colors == NULL)
+    {
+        SDL_Log("Color table could not be allocated\n");
+        exit(1);
+    }
+    display_set_color_correction(display, false);
+    // keeps the 3:2 screen undistorted, the rest of the window is letterboxed
+    SDL_RenderSetLogicalSize(display->renderer, SCREEN_WIDTH, SCREEN_HEIGHT);
     display->last_update = 0;
 }
 
 void destory_display(struct display *display)
 {
+    free(display->framebuffer);
+    free(display->colors);
+    SDL_DestroyTexture(display->texture);
     SDL_DestroyRenderer(display->renderer);
     SDL_DestroyWindow(display->window);
 }
 
 void update_display(struct display *display, int current_tick)
 {
+    SDL_UpdateTexture(display->texture, NULL, display->framebuffer, SCREEN_WIDTH * sizeof(uint32_t));
+    SDL_RenderClear(display->renderer);
+    SDL_RenderCopy(display->renderer, display->texture, NULL, NULL);
     SDL_RenderPresent(display->renderer);
     display->last_update = current_tick;
 }
 
+// widens each 5 bit channel to 8 bits, the top bits repeat in the bottom so white stays white
+static uint32_t widen_channel(uint32_t channel)
+{
+    return (channel << 3) | (channel >> 2);
+}
+
+static uint32_t rgba(uint32_t r, uint32_t g, uint32_t b)
+{
+    return (r << 24) | (g << 16) | (b << 8) | 0xFF;
+}
+
+// the lcd's response is close to a 4.0 gamma with the channels bleeding into each other, shown on a 2.2 gamma
+// screen at 255/280 of full brightness
+static uint32_t corrected_color(uint32_t r, uint32_t g, uint32_t b)
+{
+    double lr = pow(r / 31.0, 4.0);
+    double lg = pow(g / 31.0, 4.0);
+    double lb = pow(b / 31.0, 4.0);
+    double scale = 255.0 * 255.0 / 280.0;
+    uint32_t out_r = pow((0 * lb + 50 * lg + 255 * lr) / 255.0, 1 / 2.2) * scale;
+    uint32_t out_g = pow((30 * lb + 230 * lg + 10 * lr) / 255.0, 1 / 2.2) * scale;
+    uint32_t out_b = pow((220 * lb + 10 * lg + 50 * lr) / 255.0, 1 / 2.2) * scale;
+    return rgba(out_r, out_g, out_b);
+}
+
+void display_set_color_correction(struct display *display, bool color_correction)
+{
+    display->color_correction = color_correction;
+    for (uint32_t color = 0; color < BGR555_COLORS; color++)
+    {
+        uint32_t r = color & 0b11111;
+        uint32_t g = (color >> 5) & 0b11111;
+        uint32_t b = (color >> 10) & 0b11111;
+        display->colors[color] = color_correction ? corrected_color(r, g, b) : rgba(widen_channel(r), widen_channel(g), widen_channel(b));
+    }
+}
+
+#ifdef DISPLAY_SSE2
+// the plain widening done 8 pixels at a time, byte 0 of each output is alpha and byte 3 red
+static int convert_line_sse2(const uint8_t *line, uint32_t *out, int count)
+{
+    const __m128i channel = _mm_set1_epi16(0b11111);
+    const __m128i alpha = _mm_set1_epi16(0xFF);
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i colors = _mm_loadu_si128((const __m128i *)(line + i * 2));
+        __m128i r = _mm_and_si128(colors, channel);
+        __m128i g = _mm_and_si128(_mm_srli_epi16(colors, 5), channel);
+        __m128i b = _mm_and_si128(_mm_srli_epi16(colors, 10), channel);
+        r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+        g = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+        b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+        __m128i low = _mm_or_si128(_mm_slli_epi16(b, 8), alpha);
+        __m128i high = _mm_or_si128(_mm_slli_epi16(r, 8), g);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_unpacklo_epi16(low, high));
+        _mm_storeu_si128((__m128i *)(out + i + 4), _mm_unpackhi_epi16(low, high));
+    }
+    return i;
+}
+#endif
+
+void display_convert_line(struct display *display, const uint8_t *line, uint32_t *out, int count)
+{
+    int i = 0;
+#ifdef DISPLAY_SSE2
+    if (!display->color_correction)
+    {
+        i = convert_line_sse2(line, out, count);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        out[i] = display->colors[(line[i * 2] | (line[i * 2 + 1] << 8)) & (BGR555_COLORS - 1)];
+    }
+}
+
 void set_pixel(struct display *display, int x, int y, int32_t color)
 {
-    uint8_t r,g,b;
-    r = color & 0b11111;
-    g = (color & 0b11111 << 5) >> 5;
-    b = (color & 0b11111 << 10) >> 10;
-    float lerp = 0xFF / 0b11111;
-    r = (int)(r * lerp);
-    g = (int)(g * lerp);
-    b = (int)(b * lerp);
-    SDL_SetRenderDrawColor(display->renderer, r, g, b, 0xFF);
-    SDL_RenderDrawPoint(display->renderer, x, y);
-    //update_display(display, SDL_GetTicks());
+    if (x < 0 || x >= SCREEN_WIDTH || y < 0 || y >= SCREEN_HEIGHT)
+    {
+        return;
+    }
+    display->framebuffer[y * SCREEN_WIDTH + x] = display->colors[color & (BGR555_COLORS - 1)];
 }
 
-void get_pixel(struct display *display, int x, int y, int32_t *color)
+bool display_compose_bitmap(struct display *display, uint16_t control, const uint8_t *vram, const uint8_t *palette)
 {
-    SDL_Rect dst = {.x = x, .y = y, .w = 1, .h = 1};
-    if (SDL_RenderReadPixels(display->renderer, &(SDL_Rect){x, y, 1, 1}, SDL_PIXELFORMAT_RGBA8888, color, display->width) != 0)
+    int frame = control & DISPLAY_CONTROL_FRAME ? BITMAP_FRAME_SIZE : 0;
+    uint32_t *pixel = display->framebuffer;
+    if (control & DISPLAY_CONTROL_FORCED_BLANK)
     {
-        SDL_Log("Failed to read pixel, %s", SDL_GetError());
-        exit(1);
+        for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
+        {
+            pixel[i] = 0xFFFFFFFF;
+        }
+        return true;
     }
-}
\ No newline at end of file
+    switch (control & DISPLAY_CONTROL_MODE)
+    {
+    case 3:
+        for (int y = 0; y < SCREEN_HEIGHT; y++)
+        {
+            display_convert_line(display, vram + y * SCREEN_WIDTH * 2, pixel + y * SCREEN_WIDTH, SCREEN_WIDTH);
+        }
+        return true;
+    case 4:
+    {
+        // 256 colors converted once instead of one per pixel
+        uint32_t colors[256];
+        display_convert_line(display, palette, colors, 256);
+        for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
+        {
+            pixel[i] = colors[vram[frame + i]];
+        }
+        return true;
+    }
+    case 5:
+    {
+        // the smaller frame sits in the top left corner over the backdrop
+        uint32_t backdrop;
+        display_convert_line(display, palette, &backdrop, 1);
+        for (int y = 0; y < SCREEN_HEIGHT; y++)
+        {
+            uint32_t *row = pixel + y * SCREEN_WIDTH;
+            int x = 0;
+            if (y < MODE_5_HEIGHT)
+            {
+                display_convert_line(display, vram + frame + y * MODE_5_WIDTH * 2, row, MODE_5_WIDTH);
+                x = MODE_5_WIDTH;
+            }
+            for (; x < SCREEN_WIDTH; x++)
+            {
+                row[x] = backdrop;
+            }
+        }
+        return true;
+    }
+    default:
+        return false;
+    }
+}
@@ -14,11 +14,23 @@
     #include <windows.h>
 #endif
 #include "display.h"
+#include "LCD-video-controller.h"
 #include "cpu.h"
 
 #define MAX_FPS 60
 #define SECOND 1000
 
+// scanline position of the emulated lcd, driven by scheduler events
+struct lcd_timing
+{
+    struct display *display;
+    int scanline;
+    HALF_WORD display_control; // as of the last composed frame
+    struct LCD_video_controller lcd; // draws the tile modes a line at a time from hblank
+};
+
 static bool run;
+void hblank(struct cpu *cpu, void *data, uint64_t when);
+void vblank(struct cpu *cpu, void *data, uint64_t when);
 const char* open_rom();
 void load_bios(struct cpu* cpu);
\ No newline at end of file
@@ -15,32 +15,20 @@ int main(int argc, char *argv[])
     struct cpu cpu;
     cpu_init(&cpu);
     load_bios(&cpu);
-    struct request_channel channel;
-    channel.id = 258;
-    channel.memory_address = VIRTUAL_PALLETTE_RAM;
-    channel.memory_range = 640 * 480;
-    //channel.memory_range = 0x06017FFF - 0x06000000;
-    void func(struct request_data * data)
-    { // error can be ignored this syntax is for the gcc nested function declaration, will compile
-        if (data->request_type == input)
-        {
-            data->data_type = word;
-            get_pixel(&emulator, data->address % emulator.width, data->address / emulator.width, &(data->data.word));
-        }
-        else
-        {
-            set_pixel(&emulator, data->address % emulator.width, data->address / emulator.width, data->data.word);
-        }
+    // a path on the command line skips the file dialog
+    const char *rom_path = argc > 1 ? argv[1] : open_rom();
+    if (rom_path[0] != '\0' && !cpu_load_rom(&cpu, rom_path))
+    {
+        printf("Error: running without a cartridge\n");
     }
-    channel.push_to_channel = func;
-    add_request_channel(&cpu, channel);
+    struct lcd_timing video = {.display = &emulator, .scanline = 0};
+    LCD_video_controller_init(&video.lcd);
+    scheduler_add(&cpu.scheduler, HBLANK_START, EVENT_HBLANK, hblank, &video);
+    scheduler_add(&cpu.scheduler, VISIBLE_SCANLINES * CYCLES_PER_SCANLINE, EVENT_VBLANK, vblank, &video);
     while (cpu.isOn)
     {
-        if (SDL_GetTicks() - emulator.last_update > (SECOND / MAX_FPS))
-        {
-            update_display(&emulator, SDL_GetTicks());
-        }
-        cpu_loop(&cpu);
+        // a whole frame of emulation between host polls, the display is updated from the vblank event
+        cpu_run(&cpu, CYCLES_PER_FRAME);
         SDL_Event event;
         while (SDL_PollEvent(&event))
         {
@@ -74,6 +62,43 @@ int main(int argc, char *argv[])
     return 0;
 }
 
+void hblank(struct cpu *cpu, void *data, uint64_t when)
+{
+    struct lcd_timing *video = data;
+    if (video->scanline < VISIBLE_SCANLINES)
+    {
+        struct memory_map *map = &cpu->memory_map;
+        LCD_video_controller_latch(&video->lcd, map->io);
+        if (LCD_video_controller_render_scanline(&video->lcd, video->scanline, map->vram, map->palette))
+        {
+            uint32_t *row = video->display->framebuffer + video->scanline * SCREEN_WIDTH;
+            display_convert_line(video->display, (const uint8_t *)video->lcd.scanline, row, SCREEN_WIDTH);
+        }
+    }
+    video->scanline = (video->scanline + 1) % SCANLINES_PER_FRAME;
+    scheduler_add(&cpu->scheduler, when + CYCLES_PER_SCANLINE, EVENT_HBLANK, hblank, data);
+}
+
+void vblank(struct cpu *cpu, void *data, uint64_t when)
+{
+    struct lcd_timing *video = data;
+    if (SDL_GetTicks() - video->display->last_update > (SECOND / MAX_FPS))
+    {
+        struct memory_map *map = &cpu->memory_map;
+        HALF_WORD control = map->io[0] | (map->io[1] << 8);
+        // a frame nothing was stored into since the last one looks the same
+        if (control != video->display_control || memory_map_is_dirty(map, VIRTUAL_VRAM, VRAM_SIZE) || memory_map_is_dirty(map, VIRTUAL_PALLETTE_RAM, PALETTE_SIZE))
+        {
+            display_compose_bitmap(video->display, control, map->vram, map->palette);
+            memory_map_clear_dirty(map, VIRTUAL_VRAM, VRAM_SIZE);
+            memory_map_clear_dirty(map, VIRTUAL_PALLETTE_RAM, PALETTE_SIZE);
+            video->display_control = control;
+        }
+        update_display(video->display, SDL_GetTicks());
+    }
+    scheduler_add(&cpu->scheduler, when + CYCLES_PER_FRAME, EVENT_VBLANK, vblank, data);
+}
+
 const char* open_rom()
 {
     char *buffer = calloc(PATH_MAX, sizeof(char));
@@ -94,9 +119,11 @@ const char* open_rom()
         perror("file_name_dialog()");
         return "\0";
     }
-    if (strncmp(buffer + strlen(buffer) - 4 - 1, ".rom", 4) != 0)
+    buffer[strcspn(buffer, "\n")] = '\0';
+    size_t length = strlen(buffer);
+    if (length < 4 || (strcmp(buffer + length - 4, ".gba") != 0 && strcmp(buffer + length - 4, ".rom") != 0))
     {
-        printf("Error: File must be a .rom file.\n");
+        printf("Error: File must be a .gba or .rom file.\n");
         return "\0";
     }
     ret == 0; // return true if all is OK
@@ -107,7 +134,7 @@ const char* open_rom()
     ofn.lStructSize     = sizeof(ofn);
     ofn.hwndOwner       = NULL;
     ofn.hInstance       = NULL;
-    ofn.lpstrFilter     = "ROM Files\0*.rom\0\0";    
+    ofn.lpstrFilter     = "ROM Files\0*.gba;*.rom\0\0";    
     ofn.lpstrFile       = buffer;
     ofn.nMaxFile        = MAX_PATH;
     ofn.lpstrTitle      = "Please Select A File To Open";
@@ -184,10 +211,11 @@ void load_bios(struct cpu* cpu)
             fseek(f, shdr.sh_offset, SEEK_SET);
             BYTE file_buffer[shdr.sh_size];
             fread(file_buffer, shdr.sh_size, 1, f);
-            memcpy(cpu->memory, file_buffer, shdr.sh_size);
+            memcpy(cpu->memory_map.bios, file_buffer, shdr.sh_size);
             if (ehdr.e_ident[EI_DATA] == ELFDATA2MSB)
             {
                 cpu->registers[CPSR] |= E_MASK;
+                cpu_select_memory_accessors(cpu);
             }
             GElf_Phdr phdr;
             cpu->registers[PC] = ehdr.e_entry - shdr.sh_addr;
@@ -0,0 +1,174 @@
+#include <time.h>
+#include <string.h>
+#include "cpu.h"
+
+enum bench_sizes
+{
+    CONDITION_CHECKS = 1 << 26,
+    RUN_CYCLES = 1 << 24,
+    DECOMPRESS_GROUPS = 54, // 76 bytes out of every group, about 4KB in all
+    DECOMPRESS_REPEATS = 1 << 12,
+};
+
+struct cpu cpu;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the switch check_condition used before the truth table, kept as the baseline
+static bool switch_condition(WORD cpsr, int cond)
+{
+    switch (cond)
+    {
+    case 0x0:
+        return cpsr & Z_MASK;
+    case 0x1:
+        return !(cpsr & Z_MASK);
+    case 0x2:
+        return cpsr & C_MASK;
+    case 0x3:
+        return !(cpsr & C_MASK);
+    case 0x4:
+        return cpsr & N_MASK;
+    case 0x5:
+        return !(cpsr & N_MASK);
+    case 0x6:
+        return cpsr & V_MASK;
+    case 0x7:
+        return !(cpsr & V_MASK);
+    case 0x8:
+        return (cpsr & C_MASK) && !(cpsr & Z_MASK);
+    case 0x9:
+        return !(cpsr & C_MASK) || (cpsr & Z_MASK);
+    case 0xa:
+        return ((cpsr >> N_POS) & 0b1) == ((cpsr >> V_POS) & 0b1);
+    case 0xb:
+        return ((cpsr >> N_POS) & 0b1) != ((cpsr >> V_POS) & 0b1);
+    case 0xc:
+        return !(cpsr & Z_MASK) && ((cpsr >> N_POS) & 0b1) == ((cpsr >> V_POS) & 0b1);
+    case 0xd:
+        return (cpsr & Z_MASK) || ((cpsr >> N_POS) & 0b1) != ((cpsr >> V_POS) & 0b1);
+    default:
+        return cond == 0xe;
+    }
+}
+
+static void bench_condition_checks(void)
+{
+    // pseudo random conditions and flags so the switch cannot be predicted
+    WORD seed = 0x12345678;
+    int passed_switch = 0;
+    int passed_table = 0;
+    double start = now();
+    for (int i = 0; i < CONDITION_CHECKS; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        passed_switch += switch_condition(seed & 0xF0000000, (seed >> 8) % 0xE);
+    }
+    double switch_time = now() - start;
+    seed = 0x12345678;
+    start = now();
+    for (int i = 0; i < CONDITION_CHECKS; i++)
+    {
+        seed = seed * 1664525 + 1013904223;
+        cpu.registers[CPSR] = seed & 0xF0000000;
+        passed_table += cpu_check_condition_code(&cpu, (seed >> 8) % 0xE);
+    }
+    double table_time = now() - start;
+    printf("condition switch: %.2f ns/check\n", switch_time * 1e9 / CONDITION_CHECKS);
+    printf("condition table:  %.2f ns/check\n", table_time * 1e9 / CONDITION_CHECKS);
+    if (passed_switch != passed_table)
+    {
+        printf("Error: switch and table disagree, %d != %d\n", passed_switch, passed_table);
+    }
+}
+
+static void bench_conditional_loop(void)
+{
+    cpu.registers[CPSR] = E_MASK;
+    write_word_to_memory(&cpu, 0x100, 0xE3500000); // CMP r0, #0
+    write_word_to_memory(&cpu, 0x104, 0x02811001); // ADDEQ r1, r1, #1
+    write_word_to_memory(&cpu, 0x108, 0x12822001); // ADDNE r2, r2, #1
+    write_word_to_memory(&cpu, 0x10C, 0xC2833001); // ADDGT r3, r3, #1
+    write_word_to_memory(&cpu, 0x110, 0xEAFFFFFA); // B 0x100
+    cpu.registers[PC] = 0x100;
+    uint64_t start_cycles = cpu.cycles;
+    double start = now();
+    cpu_run(&cpu, RUN_CYCLES);
+    double time = now() - start;
+    // every loop is 5 instructions and 7 cycles
+    double instructions = (cpu.cycles - start_cycles) * 5.0 / 7.0;
+    printf("conditional loop: %.2f ns/instruction\n", time * 1e9 / instructions);
+}
+
+// lz77 groups of alternating literals and 18 byte copies
+static WORD build_lz77_stream(WORD address)
+{
+    WORD size = DECOMPRESS_GROUPS * 76;
+    BYTE *stream = memory_map_pointer(&cpu.memory_map, address);
+    *stream++ = 0x10;
+    *stream++ = size & 0xFF;
+    *stream++ = (size >> 8) & 0xFF;
+    *stream++ = (size >> 16) & 0xFF;
+    for (int group = 0; group < DECOMPRESS_GROUPS; group++)
+    {
+        *stream++ = 0x55;
+        for (int i = 0; i < 4; i++)
+        {
+            *stream++ = group * 4 + i;
+            *stream++ = 0xF0;
+            *stream++ = 0x00;
+        }
+    }
+    return size;
+}
+
+static void bench_decompression(void)
+{
+    cpu.registers[CPSR] = E_MASK;
+    WORD size = build_lz77_stream(0x100);
+    double megabytes = (double)size * DECOMPRESS_REPEATS / (MB);
+    double start = now();
+    for (int i = 0; i < DECOMPRESS_REPEATS; i++)
+    {
+        cpu.registers[R0] = 0x100;
+        cpu.registers[R1] = 0x1000;
+        gba_lz77_write_16_bit(&cpu);
+    }
+    printf("native lz77:       %.1f MB/s\n", megabytes / (now() - start));
+    // the bios in this tree has no decoder to interpret, so the baseline is the cheapest loop one could be,
+    // an interpreted word copy of the same output
+    write_word_to_memory(&cpu, 0x3800, 0xE5B03004); // LDR r3, [r0, #4]!
+    write_word_to_memory(&cpu, 0x3804, 0xE5A13004); // STR r3, [r1, #4]!
+    write_word_to_memory(&cpu, 0x3808, 0xE2522001); // SUBS r2, r2, #1
+    write_word_to_memory(&cpu, 0x380C, 0x1AFFFFFB); // BNE 0x3800
+    write_word_to_memory(&cpu, 0x3810, 0xEAFFFFFE); // B .
+    start = now();
+    for (int i = 0; i < DECOMPRESS_REPEATS; i++)
+    {
+        cpu.registers[R0] = 0x1000 - sizeof(WORD);
+        cpu.registers[R1] = 0x2200 - sizeof(WORD);
+        cpu.registers[R2] = size / sizeof(WORD);
+        cpu.registers[PC] = 0x3800;
+        cpu_run(&cpu, size * 4);
+    }
+    printf("interpreted copy:  %.1f MB/s\n", megabytes / (now() - start));
+    if (cpu.registers[PC] != 0x3810 || memcmp(memory_map_pointer(&cpu.memory_map, 0x1000), memory_map_pointer(&cpu.memory_map, 0x2200), size - size % sizeof(WORD)) != 0)
+    {
+        printf("Error: interpreted copy did not finish\n");
+    }
+}
+
+int main(void)
+{
+    cpu_init(&cpu);
+    bench_condition_checks();
+    bench_conditional_loop();
+    bench_decompression();
+    free_cpu(&cpu);
+    return 0;
+}
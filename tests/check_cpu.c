@@ -1,5 +1,12 @@
 #include <check.h>
+#include <string.h>
 #include "cpu.h"
+#ifdef CPU_JIT
+#include "jit.h"
+#endif
+#ifdef CPU_FASTMEM
+#include "fastmem.h"
+#endif
 
 struct cpu cpu;
 
@@ -51,14 +58,773 @@ START_TEST(check_read_write)
 }
 END_TEST
 
+START_TEST(check_endian_accessors)
+{
+    // the stored byte order follows the E bit once cpu_set_cpsr picks the accessors for it
+    BYTE *host = memory_map_pointer(&cpu.memory_map, 0x100);
+    cpu_set_cpsr(&cpu, cpu.registers[CPSR] & ~E_MASK);
+    write_word_to_memory(&cpu, 0x100, 0x12345678);
+    ck_assert_int_eq(host[0], 0x12);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, 0x102), 0x5678);
+    cpu_set_cpsr(&cpu, cpu.registers[CPSR] | E_MASK);
+    write_word_to_memory(&cpu, 0x100, 0x12345678);
+    ck_assert_int_eq(host[0], 0x78);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, 0x102), 0x1234);
+    // unaligned addresses are kept, not rounded down
+    write_word_to_memory(&cpu, 0x101, 0xAABBCCDD);
+    ck_assert_int_eq(host[0], 0x78);
+    ck_assert_int_eq(host[1], 0xDD);
+    ck_assert_int_eq(read_word_from_memory(&cpu, 0x101), 0xAABBCCDD);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, 0x103), 0xAABB);
+    // and one running off the end of ewram wraps to its start like the bytes would
+    write_word_to_memory(&cpu, 0x0203FFFE, 0x12345678);
+    ck_assert_int_eq(read_byte_from_memory(&cpu, 0x0203FFFF), 0x56);
+    ck_assert_int_eq(read_byte_from_memory(&cpu, 0x02000000), 0x34);
+    ck_assert_int_eq(read_word_from_memory(&cpu, 0x0203FFFE), 0x12345678);
+    cpu_set_cpsr(&cpu, cpu.registers[CPSR] & ~E_MASK);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, 0x0203FFFF), 0x5634);
+}
+END_TEST
+
+START_TEST(check_arm_decode)
+{
+    ck_assert_int_eq(cpu_decode_arm_instruction(0xEA000000), BRANCH); // B
+    ck_assert_int_eq(cpu_decode_arm_instruction(0xE12FFF10), BRANCH_AND_EXCHANGE); // BX r0
+    ck_assert_int_eq(cpu_decode_arm_instruction(0xEF000000), SOFTWARE_INTERRUPT); // SWI 0
+    ck_assert_int_eq(cpu_decode_arm_instruction(0xE3A00000), DATA_PROCESSING); // MOV r0, #0
+    ck_assert_int_eq(cpu_decode_arm_instruction(0xE0000091), MULTIPLY); // MUL r0, r1, r0
+    ck_assert_int_eq(cpu_decode_arm_instruction(0xE5900000), SINGLE_DATA_TRANSFER); // LDR r0, [r0]
+    ck_assert_int_eq(cpu_decode_arm_instruction(0xE8900000), BLOCK_DATA_TRANSFER); // LDM r0, {}
+    ck_assert_int_eq(cpu_decode_arm_instruction(0xE1500001), DATA_PROCESSING); // CMP r0, r1
+    ck_assert_int_eq(cpu_decode_arm_instruction(0xE1010092), SINGLE_DATA_SWAP); // SWP r0, r2, [r1]
+    ck_assert_int_eq(cpu_decode_arm_instruction(0xE1D100B2), HDS_DATA_TRANSFER); // LDRH r0, [r1, #2]
+    ck_assert_int_eq(cpu_decode_arm_instruction(0xE10F0000), PSR_TRANSFER); // MRS r0, cpsr
+    ck_assert_int_eq(cpu_lookup_arm_instruction(0xEA000000)->execute == arm_branch, true);
+}
+END_TEST
+
+START_TEST(check_thumb_decode)
+{
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0xDF00), THUMB_SOFTWARE_INTERRUPT); // SWI 0
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0xD000), THUMB_CONDITIONAL_BRANCH); // BEQ
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0xE000), THUMB_UNCONDITIONAL_BRANCH); // B
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0xF000), THUMB_LONG_BRANCH_AND_LINK); // BL
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0x1888), THUMB_ADD_SUB); // ADD r0, r1, r2
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0x0048), THUMB_MOVE_SHIFTED_REGISTER); // LSL r0, r1, #1
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0x2000), THUMB_MOV_CMP_ADD_SUB_IMM); // MOV r0, #0
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0x4008), THUMB_ALU_OPERATIONS); // AND r0, r1
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0x4700), THUMB_HI_REG_OPERATION_BRANCH_EXCHANGE); // BX r0
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0x4800), THUMB_PC_RELATIVE_LOAD); // LDR r0, [pc]
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0x5000), THUMB_LOAD_STORE_WITH_REG_OFFSET); // STR r0, [r0, r0]
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0x5200), THUMB_LOAD_STORE_SIGN_EXTENDED_BYTE_HALFWORD); // STRH r0, [r0, r0]
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0xB500), THUMB_PUSH_POP_REGISTERS); // PUSH {lr}
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0xB000), THUMB_OFFSET_STACKPOINTER); // ADD sp, #0
+    ck_assert_int_eq(cpu_decode_thumb_instruction(0xB100), THUMB_UNDEFINED);
+}
+END_TEST
+
+START_TEST(check_block_cache)
+{
+#ifdef CPU_JIT
+    jit_destroy(cpu.jit);
+    cpu.jit = NULL;
+#endif
+    write_word_to_memory(&cpu, 0x100, 0xE3A00001); // MOV r0, #1
+    write_word_to_memory(&cpu, 0x104, 0xE2800001); // ADD r0, r0, #1
+    write_word_to_memory(&cpu, 0x108, 0xEAFFFFFE); // B .
+    cpu.registers[PC] = 0x100;
+    cpu_loop(&cpu);
+    ck_assert_int_eq(cpu.registers[R0], 2);
+    ck_assert_int_eq(cpu.registers[PC], 0x108);
+    ck_assert_int_eq(cpu.block_cache.misses, 1);
+    cpu_loop(&cpu);
+    cpu_loop(&cpu);
+    ck_assert_int_eq(cpu.block_cache.misses, 2);
+    ck_assert_int_eq(cpu.block_cache.hits, 1);
+    // overwriting code drops every block that covers it
+    write_word_to_memory(&cpu, 0x108, 0xEAFFFFFE);
+    ck_assert_int_eq(cpu.block_cache.invalidations, 2);
+    cpu_loop(&cpu);
+    ck_assert_int_eq(cpu.block_cache.misses, 3);
+}
+END_TEST
+
+START_TEST(check_cpu_run)
+{
+    write_word_to_memory(&cpu, 0x100, 0xE3A00001); // MOV r0, #1
+    write_word_to_memory(&cpu, 0x104, 0xEAFFFFFE); // B .
+    cpu.registers[PC] = 0x100;
+    int cycles = cpu_run(&cpu, CYCLES_PER_SCANLINE);
+    ck_assert(cycles >= CYCLES_PER_SCANLINE);
+    ck_assert(cycles < CYCLES_PER_SCANLINE + 8);
+    ck_assert_int_eq(cpu.cycles, cycles);
+    ck_assert_int_eq(cpu.registers[R0], 1);
+    ck_assert_int_eq(cpu.registers[PC], 0x104);
+    cpu.isOn = false;
+    ck_assert_int_eq(cpu_run(&cpu, CYCLES_PER_FRAME), 0);
+}
+END_TEST
+
+START_TEST(check_thumb_run)
+{
+    write_half_word_to_memory(&cpu, 0x200, 0x2005); // MOV r0, #5
+    write_half_word_to_memory(&cpu, 0x202, 0x4680); // MOV r8, r0
+    write_half_word_to_memory(&cpu, 0x204, 0xBD00); // POP {pc}
+    write_half_word_to_memory(&cpu, 0x300, 0x2107); // MOV r1, #7
+    write_half_word_to_memory(&cpu, 0x302, 0x4770); // BX lr
+    write_half_word_to_memory(&cpu, 0x400, 0x4710); // BX r2
+    write_word_to_memory(&cpu, 0x500, 0xEAFFFFFE);  // B .
+    write_word_to_memory(&cpu, 0x3000100, 0x301);
+    cpu.registers[SP] = 0x3000100;
+    cpu.registers[LR] = 0x401;
+    cpu.registers[R2] = 0x500;
+    cpu.registers[CPSR] |= T_MASK;
+    cpu.registers[PC] = 0x200;
+    cpu_run(&cpu, 100);
+    ck_assert_int_eq(cpu.registers[R0], 5);
+    ck_assert_int_eq(cpu.registers[R8], 5);
+    ck_assert_int_eq(cpu.registers[R1], 7);
+    ck_assert_int_eq(cpu.registers[SP], 0x3000104);
+    ck_assert_int_eq(cpu.registers[PC], 0x500);
+    ck_assert_int_eq(cpu.registers[CPSR] & T_MASK, 0);
+    // format 1 shifts by an immediate
+    cpu.registers[R1] = 3;
+    thumb_move_shifted_register(&cpu, 0x0088); // LSL r0, r1, #2
+    ck_assert_int_eq(cpu.registers[R0], 12);
+    cpu.registers[R1] = 0x80000010;
+    thumb_move_shifted_register(&cpu, 0x0908); // LSR r0, r1, #4
+    ck_assert_int_eq(cpu.registers[R0], 0x08000001);
+    thumb_move_shifted_register(&cpu, 0x1108); // ASR r0, r1, #4
+    ck_assert_int_eq(cpu.registers[R0], 0xF8000001);
+}
+END_TEST
+
+START_TEST(check_register_banking)
+{
+    cpu_set_cpsr(&cpu, (cpu.registers[CPSR] & ~MODE_MASK) | USER);
+    cpu.registers[R8] = 8;
+    cpu.registers[SP] = 0x100;
+    cpu_switch_mode(&cpu, FIQ);
+    ck_assert_int_eq(cpu.registers[R8], 0);
+    cpu.registers[R8] = 0x88;
+    cpu.registers[SP] = 0x200;
+    cpu_switch_mode(&cpu, SVC);
+    ck_assert_int_eq(cpu.registers[R8], 8);
+    ck_assert_int_eq(cpu.registers[SP], SVC_STACK_START);
+    cpu_switch_mode(&cpu, USER);
+    ck_assert_int_eq(cpu.registers[R8], 8);
+    ck_assert_int_eq(cpu.registers[SP], 0x100);
+    ck_assert_int_eq(cpu.registers[R8_FIQ], 0x88);
+    ck_assert_int_eq(cpu.registers[SP_FIQ], 0x200);
+    // software interrupts enter svc with the return address in the svc link register
+    WORD user_cpsr = cpu.registers[CPSR];
+    cpu.registers[LR] = 0x1234;
+    cpu.registers[PC] = 0x100;
+    arm_software_interrupt(&cpu, 0xEF000000);
+    ck_assert_int_eq(cpu.registers[CPSR] & MODE_MASK, SVC);
+    ck_assert_int_eq(cpu.registers[LR], 0x104);
+    ck_assert_int_eq(cpu.registers[SPSR_SVC], user_cpsr);
+    ck_assert_int_eq(cpu_spsr_register(&cpu), SPSR_SVC);
+    cpu_set_cpsr(&cpu, cpu.registers[SPSR_SVC]);
+    ck_assert_int_eq(cpu.registers[LR], 0x1234);
+}
+END_TEST
+
+START_TEST(check_lazy_flags)
+{
+    cpu.registers[CPSR] &= ~(N_MASK | Z_MASK | C_MASK | V_MASK);
+    cpu.registers[R0] = 1;
+    arm_data_processing(&cpu, 0xE2500001); // SUBS r0, r0, #1
+    ck_assert_int_eq(cpu.registers[R0], 0);
+    // nothing is written to CPSR until a condition is checked
+    ck_assert_int_eq(cpu.registers[CPSR] & Z_MASK, 0);
+    ck_assert(check_condition(&cpu, 0x00000000)); // EQ
+    ck_assert(check_condition(&cpu, 0x20000000)); // CS, no borrow
+    ck_assert_int_eq(cpu.registers[CPSR] & (N_MASK | Z_MASK | C_MASK | V_MASK), Z_MASK | C_MASK);
+    arm_data_processing(&cpu, 0xE3500001); // CMP r0, #1
+    ck_assert(check_condition(&cpu, 0xB0000000)); // LT
+    ck_assert(check_condition(&cpu, 0x30000000)); // CC, borrow
+    cpu.registers[R1] = 0x7FFFFFFF;
+    arm_data_processing(&cpu, 0xE2912001); // ADDS r2, r1, #1
+    ck_assert(check_condition(&cpu, 0x60000000)); // VS
+    ck_assert(check_condition(&cpu, 0x40000000)); // MI
+    // logical ops leave C and V alone
+    arm_data_processing(&cpu, 0xE1B03000); // MOVS r3, r0
+    cpu_materialize_flags(&cpu);
+    ck_assert_int_eq(cpu.registers[CPSR] & (N_MASK | Z_MASK | C_MASK | V_MASK), Z_MASK | V_MASK);
+    // even when the compare before them is still pending
+    cpu.registers[R0] = 5;
+    cpu.registers[R1] = 3;
+    arm_data_processing(&cpu, 0xE1500001); // CMP r0, r1
+    arm_data_processing(&cpu, 0xE3B02000); // MOVS r2, #0
+    ck_assert(check_condition(&cpu, 0x20000000)); // CS
+    ck_assert(check_condition(&cpu, 0x00000000)); // EQ
+    write_word_to_memory(&cpu, 0x100, 0xE1500001); // CMP r0, r1
+    write_word_to_memory(&cpu, 0x104, 0xE3B02000); // MOVS r2, #0
+    write_word_to_memory(&cpu, 0x108, 0x23A03001); // MOVCS r3, #1
+    write_word_to_memory(&cpu, 0x10C, 0xEAFFFFFE); // B .
+    cpu.registers[R3] = 0;
+    cpu.registers[PC] = 0x100;
+    cpu_run(&cpu, 10);
+    ck_assert_int_eq(cpu.registers[R3], 1);
+}
+END_TEST
+
+START_TEST(check_condition_table)
+{
+    cpu.registers[CPSR] = (cpu.registers[CPSR] & ~(N_MASK | Z_MASK | C_MASK | V_MASK)) | N_MASK | V_MASK;
+    ck_assert(cpu_check_condition_code(&cpu, 0xa)); // GE
+    ck_assert(cpu_check_condition_code(&cpu, 0xc)); // GT
+    ck_assert(!cpu_check_condition_code(&cpu, 0xb)); // LT
+    ck_assert(!cpu_check_condition_code(&cpu, 0xf)); // NV
+    // thumb conditional branches share the table
+    cpu.registers[PC] = 0x100;
+    thumb_conditional_branch(&cpu, 0xDC02); // BGT +4
+    ck_assert_int_eq(cpu.registers[PC], 0x108);
+    thumb_conditional_branch(&cpu, 0xDB02); // BLT +4
+    ck_assert_int_eq(cpu.registers[PC], 0x10A);
+}
+END_TEST
+
+static void record_event(struct cpu *cpu, void *data, uint64_t when)
+{
+    uint64_t *fired = data;
+    fired[0] = when;
+    fired[1] = cpu->cycles;
+}
+
+START_TEST(check_scheduler)
+{
+    uint64_t first[2] = {0, 0};
+    uint64_t second[2] = {0, 0};
+    uint64_t cancelled[2] = {0, 0};
+    write_word_to_memory(&cpu, 0x100, 0xEAFFFFFE); // B .
+    cpu.registers[PC] = 0x100;
+    scheduler_add(&cpu.scheduler, 500, EVENT_VBLANK, record_event, second);
+    scheduler_add(&cpu.scheduler, 100, EVENT_HBLANK, record_event, first);
+    scheduler_add(&cpu.scheduler, 300, EVENT_TIMER_0, record_event, cancelled);
+    ck_assert_int_eq(scheduler_next_deadline(&cpu.scheduler), 100);
+    scheduler_cancel(&cpu.scheduler, EVENT_TIMER_0);
+    cpu_run(&cpu, 1000);
+    // events fire on the first block boundary at or after their deadline
+    ck_assert_int_eq(first[0], 100);
+    ck_assert(first[1] >= 100 && first[1] < 104);
+    ck_assert_int_eq(second[0], 500);
+    ck_assert(second[1] >= 500 && second[1] < 504);
+    ck_assert_int_eq(cancelled[0], 0);
+    ck_assert_int_eq(cpu.scheduler.event_count, 0);
+}
+END_TEST
+
+static void release_spin(struct cpu *cpu, void *data, uint64_t when)
+{
+    write_word_to_memory(cpu, 0x200, 1);
+}
+
+START_TEST(check_idle_loop)
+{
+    write_word_to_memory(&cpu, 0x100, 0xE5910000); // LDR r0, [r1]
+    write_word_to_memory(&cpu, 0x104, 0xE3500001); // CMP r0, #1
+    write_word_to_memory(&cpu, 0x108, 0x1AFFFFFC); // BNE 0x100
+    write_word_to_memory(&cpu, 0x10C, 0xEAFFFFFE); // B .
+    write_word_to_memory(&cpu, 0x300, 0xE2822001); // ADD r2, r2, #1
+    write_word_to_memory(&cpu, 0x304, 0xEAFFFFFD); // B 0x300
+    cpu.registers[R1] = 0x200;
+    cpu.registers[PC] = 0x100;
+    scheduler_add(&cpu.scheduler, 1000, EVENT_USER, release_spin, NULL);
+    cpu_run(&cpu, 1000);
+    // the spin is skipped straight to the event that ends it
+    ck_assert_int_eq(cpu.block_cache.idle_skips, 1);
+    ck_assert(cpu.block_cache.idle_cycles_skipped > 900);
+    ck_assert_int_eq(cpu.cycles, 1000);
+    cpu_run(&cpu, 100);
+    ck_assert_int_eq(cpu.registers[PC], 0x10C);
+    // a loop that counts is never idle unless a game override says so
+    cpu.registers[PC] = 0x300;
+    uint64_t skips = cpu.block_cache.idle_skips;
+    cpu_run(&cpu, 100);
+    ck_assert_int_eq(cpu.block_cache.idle_skips, skips);
+    ck_assert(cpu.registers[R2] > 1);
+    block_cache_add_idle_override(&cpu.block_cache, 0x300);
+    cpu_run(&cpu, 100);
+    ck_assert_int_eq(cpu.block_cache.idle_skips, skips + 1);
+}
+END_TEST
+
+START_TEST(check_hle_syscalls)
+{
+    write_word_to_memory(&cpu, 0x100, 0xEF060000); // SWI 0x06, Div
+    cpu.registers[R0] = -7;
+    cpu.registers[R1] = 2;
+    cpu.registers[PC] = 0x100;
+    cpu_loop(&cpu);
+    ck_assert_int_eq((int)cpu.registers[R0], -3);
+    ck_assert_int_eq((int)cpu.registers[R1], -1);
+    ck_assert_int_eq(cpu.registers[R3], 3);
+    ck_assert_int_eq(cpu.registers[PC], 0x104);
+    cpu.registers[R0] = 0x80000000;
+    cpu.registers[R1] = -1;
+    gba_div(&cpu);
+    ck_assert_int_eq(cpu.registers[R0], 0x80000000);
+    ck_assert_int_eq(cpu.registers[R1], 0);
+    ck_assert_int_eq(cpu.registers[R3], 0x80000000);
+    cpu.registers[R0] = 9;
+    cpu.registers[R1] = -1;
+    gba_div(&cpu);
+    ck_assert_int_eq((int)cpu.registers[R0], -9);
+    ck_assert_int_eq(cpu.registers[R3], 9);
+    cpu.registers[R0] = 0x10000;
+    gba_sqrt(&cpu);
+    ck_assert_int_eq(cpu.registers[R0], 0x100);
+    cpu.registers[R0] = 0x100;
+    cpu.registers[R1] = 0x100;
+    gba_arctan2(&cpu);
+    ck_assert(cpu.registers[R0] >= 0x1FF0 && cpu.registers[R0] <= 0x2010);
+    // thumb swi, then the same call forced back to the bios
+    write_half_word_to_memory(&cpu, 0x200, 0xDF0D); // SWI 0x0D, GetBiosChecksum
+    cpu.registers[CPSR] |= T_MASK;
+    cpu.registers[PC] = 0x200;
+    cpu_loop(&cpu);
+    ck_assert_int_eq(cpu.registers[R0], GBA_BIOS_CHECKSUM);
+    ck_assert_int_eq(cpu.registers[PC], 0x202);
+    cpu_set_syscall_lle(&cpu, GET_BIOS_CHECKSUM, true);
+    cpu.registers[PC] = 0x200;
+    cpu_loop(&cpu);
+    ck_assert_int_eq(cpu.registers[PC], SOFTWARE_INTERRUPT_VECTOR);
+    ck_assert_int_eq(cpu.registers[CPSR] & MODE_MASK, SVC);
+}
+END_TEST
+
+static int channel_writes;
+
+static void count_channel_write(struct request_data *data)
+{
+    if (data->request_type == output && data->data.word == 0x11223344)
+    {
+        channel_writes++;
+    }
+}
+
+START_TEST(check_cpu_set)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        write_half_word_to_memory(&cpu, 0x1000 + i * 2, 0x100 + i);
+    }
+    cpu.registers[R0] = 0x1000;
+    cpu.registers[R1] = 0x1100;
+    cpu.registers[R2] = 4;
+    gba_cpu_set(&cpu);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, 0x1106), 0x103);
+    // a fill repeats the source word, CpuFastSet rounds the count up to blocks of 8
+    write_word_to_memory(&cpu, 0x1200, 0x11223344);
+    cpu.registers[R0] = 0x1200;
+    cpu.registers[R1] = 0x1300;
+    cpu.registers[R2] = 3 | (0b1 << 24);
+    gba_cpu_fast_set(&cpu);
+    ck_assert_int_eq(read_word_from_memory(&cpu, 0x131C), 0x11223344);
+    ck_assert_int_eq(read_word_from_memory(&cpu, 0x1320), 0);
+    // whatever runs from the last iwram mirror into a channel goes out through it a word at a time
+    channel_writes = 0;
+    add_request_channel(&cpu, (struct request_channel){.name = "test", .id = 1, .memory_address = VIRTUAL_IO_REGISTERS, .memory_range = 0x100, .push_to_channel = count_channel_write});
+    cpu.registers[R1] = VIRTUAL_IO_REGISTERS - 4;
+    cpu.registers[R2] = 4 | (0b1 << 24) | (0b1 << 26);
+    gba_cpu_set(&cpu);
+    ck_assert_int_eq(read_word_from_memory(&cpu, VIRTUAL_WRAM_CHIP_START + IWRAM_SIZE - 4), 0x11223344);
+    ck_assert_int_eq(channel_writes, 3);
+}
+END_TEST
+
+static int channel_half_words;
+static int channel_bytes;
+
+static void count_channel_sizes(struct request_data *data)
+{
+    channel_half_words += data->data_type == half_word;
+    channel_bytes += data->data_type == byte;
+}
+
+static void write_bytes(WORD address, const BYTE *bytes, int count)
+{
+    memcpy(memory_map_pointer(&cpu.memory_map, address), bytes, count);
+}
+
+START_TEST(check_decompression)
+{
+    // literals ABC then a copy of 7 from 3 back
+    const BYTE lz77[] = {0x10, 0x0A, 0x00, 0x00, 0x10, 'A', 'B', 'C', 0x40, 0x02};
+    write_bytes(0x1000, lz77, sizeof(lz77));
+    cpu.registers[R0] = 0x1000;
+    cpu.registers[R1] = 0x1100;
+    gba_lz77_write_8_bit(&cpu);
+    ck_assert(memcmp(memory_map_pointer(&cpu.memory_map, 0x1100), "ABCABCABCA", 10) == 0);
+    cpu.registers[R1] = 0x1200;
+    gba_lz77_write_16_bit(&cpu);
+    ck_assert(memcmp(memory_map_pointer(&cpu.memory_map, 0x1200), "ABCABCABCA", 10) == 0);
+    // a tree with a on 0 and b on 1, then the bits 0110
+    const BYTE huffman[] = {0x28, 0x04, 0x00, 0x00, 0x01, 0xC0, 'a', 'b', 0x00, 0x00, 0x00, 0x60};
+    write_bytes(0x1000, huffman, sizeof(huffman));
+    gba_huffman(&cpu);
+    ck_assert(memcmp(memory_map_pointer(&cpu.memory_map, 0x1200), "abba", 4) == 0);
+    const BYTE diff[] = {0x81, 0x04, 0x00, 0x00, 0x01, 0x01, 0x01, 0x01};
+    write_bytes(0x1000, diff, sizeof(diff));
+    gba_diff_8_bit_write_8_bit(&cpu);
+    ck_assert_int_eq(read_word_from_memory(&cpu, 0x1200), 0x04030201);
+    const BYTE unpack[] = {0xB1, 0x00, 0x00, 0x00, 0x01, 0x00, 0x01, 0x04, 0x00, 0x00, 0x00, 0x00};
+    write_bytes(0x1000, unpack, sizeof(unpack));
+    cpu.registers[R2] = 0x1004;
+    gba_bit_unpack(&cpu);
+    ck_assert_int_eq(read_word_from_memory(&cpu, 0x1200), 0x10110001);
+    // the vram variant never sends a lone byte
+    const BYTE run[] = {0x30, 0x06, 0x00, 0x00, 0x83, 0x55};
+    write_bytes(0x1000, run, sizeof(run));
+    add_request_channel(&cpu, (struct request_channel){.name = "test", .id = 1, .memory_address = VIRTUAL_IO_REGISTERS, .memory_range = 0x100, .push_to_channel = count_channel_sizes});
+    channel_half_words = 0;
+    channel_bytes = 0;
+    cpu.registers[R1] = VIRTUAL_IO_REGISTERS;
+    gba_rl_write_16_bit(&cpu);
+    ck_assert_int_eq(channel_half_words, 3);
+    ck_assert_int_eq(channel_bytes, 0);
+}
+END_TEST
+
+START_TEST(check_affine_set)
+{
+    // 40 sprites runs past one batch, the last is turned a quarter
+    for (int i = 0; i < 40; i++)
+    {
+        write_half_word_to_memory(&cpu, 0x1000 + i * 8, 0x100);
+        write_half_word_to_memory(&cpu, 0x1002 + i * 8, 0x100);
+        write_half_word_to_memory(&cpu, 0x1004 + i * 8, i == 39 ? 0x4000 : 0);
+    }
+    cpu.registers[R0] = 0x1000;
+    cpu.registers[R1] = 0x1200;
+    cpu.registers[R2] = 40;
+    cpu.registers[R3] = 8;
+    gba_obj_affine_set(&cpu);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, 0x1200), 0x100);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, 0x1208), 0);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, 0x1218), 0x100);
+    WORD last = 0x1200 + 39 * 32;
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, last), 0);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, last + 8), 0xFF00);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, last + 16), 0x100);
+    // at a scale of 64.0 pc is the bios's sine of angle 0x0900, 0x0E05, where rounding would give 0x0E06
+    write_half_word_to_memory(&cpu, 0x1000, 0x4000);
+    write_half_word_to_memory(&cpu, 0x1002, 0x4000);
+    write_half_word_to_memory(&cpu, 0x1004, 0x0900);
+    cpu.registers[R2] = 1;
+    gba_obj_affine_set(&cpu);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, 0x1200), 0x3E71);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, 0x1208), (HALF_WORD)-0x0E05);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, 0x1210), 0x0E05);
+    // the background centre 120, 80 of the screen is put on 0x80.00, 0x80.00 of the map
+    write_word_to_memory(&cpu, 0x1000, 0x8000);
+    write_word_to_memory(&cpu, 0x1004, 0x8000);
+    write_half_word_to_memory(&cpu, 0x1008, 120);
+    write_half_word_to_memory(&cpu, 0x100A, 80);
+    write_half_word_to_memory(&cpu, 0x100C, 0x100);
+    write_half_word_to_memory(&cpu, 0x100E, 0x100);
+    write_half_word_to_memory(&cpu, 0x1010, 0);
+    cpu.registers[R2] = 1;
+    gba_bg_affine_set(&cpu);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, 0x1200), 0x100);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, 0x1206), 0x100);
+    ck_assert_int_eq(read_word_from_memory(&cpu, 0x1208), 0x800);
+    ck_assert_int_eq(read_word_from_memory(&cpu, 0x120C), 0x3000);
+}
+END_TEST
+
+START_TEST(check_memory_map)
+{
+    write_word_to_memory(&cpu, VIRTUAL_WRAM_BOARD_START, 0x12345678);
+    ck_assert_int_eq(read_word_from_memory(&cpu, VIRTUAL_WRAM_BOARD_START + EWRAM_SIZE), 0x12345678);
+    write_half_word_to_memory(&cpu, VIRTUAL_VRAM + 0x10000, 0xBEEF);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, VIRTUAL_VRAM + 0x18000), 0xBEEF);
+    write_half_word_to_memory(&cpu, VIRTUAL_PALLETTE_RAM + 2, 0x7FFF);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, VIRTUAL_PALLETTE_RAM + PALETTE_SIZE + 2), 0x7FFF);
+    // no rom loaded reads as 0, then every wait state window shows the same rom
+    ck_assert_int_eq(read_word_from_memory(&cpu, VIRUTAL_ROM_WAIT_STATE_1), 0);
+    static BYTE rom[MEMORY_PAGE_SIZE] = {0x78, 0x56, 0x34, 0x12};
+    memory_map_set_rom(&cpu.memory_map, rom, sizeof(rom), -1);
+    ck_assert_int_eq(read_word_from_memory(&cpu, VIRUTAL_ROM_WAIT_STATE_1), 0x12345678);
+    ck_assert_int_eq(read_word_from_memory(&cpu, VIRTUAL_ROM_WAIT_STATE_3), 0x12345678);
+    // a channel takes its pages away from memory until it is removed
+    struct request_channel channel = {.name = "test", .id = 1, .memory_address = VIRTUAL_PALLETTE_RAM, .memory_range = PALETTE_SIZE, .push_to_channel = count_channel_write};
+    add_request_channel(&cpu, channel);
+    channel_writes = 0;
+    write_word_to_memory(&cpu, VIRTUAL_PALLETTE_RAM, 0x11223344);
+    ck_assert_int_eq(channel_writes, 1);
+    remove_request_channel(&cpu, channel);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, VIRTUAL_PALLETTE_RAM + 2), 0x7FFF);
+}
+END_TEST
+
+static int first_channel_hits;
+static int second_channel_hits;
+
+static void first_channel(struct request_data *data)
+{
+    first_channel_hits++;
+}
+
+static void second_channel(struct request_data *data)
+{
+    second_channel_hits++;
+    data->data.word = data->address;
+}
+
+START_TEST(check_mmio_dispatch)
+{
+    // two channels inside one 4 KB page, added out of order
+    ck_assert(add_request_channel(&cpu, (struct request_channel){.name = "second", .id = 2, .memory_address = VIRTUAL_IO_REGISTERS + 0x200, .memory_range = 0x10, .push_to_channel = second_channel}));
+    ck_assert(add_request_channel(&cpu, (struct request_channel){.name = "first", .id = 1, .memory_address = VIRTUAL_IO_REGISTERS, .memory_range = 0x100, .push_to_channel = first_channel}));
+    ck_assert(!add_request_channel(&cpu, (struct request_channel){.name = "overlap", .id = 3, .memory_address = VIRTUAL_IO_REGISTERS + 0xF0, .memory_range = 0x20, .push_to_channel = first_channel}));
+    ck_assert(!add_request_channel(&cpu, (struct request_channel){.name = "same id", .id = 1, .memory_address = VIRTUAL_VRAM, .memory_range = 0x20, .push_to_channel = first_channel}));
+    first_channel_hits = 0;
+    second_channel_hits = 0;
+    ck_assert_int_eq(read_word_from_memory(&cpu, VIRTUAL_IO_REGISTERS + 0x208), 0x8);
+    write_word_to_memory(&cpu, VIRTUAL_IO_REGISTERS + 0x10, 0);
+    // between the two channels the io registers are plain memory
+    write_word_to_memory(&cpu, VIRTUAL_IO_REGISTERS + 0x180, 0x12345678);
+    ck_assert_int_eq(read_word_from_memory(&cpu, VIRTUAL_IO_REGISTERS + 0x180), 0x12345678);
+    write_byte_to_memory(&cpu, VIRTUAL_IO_REGISTERS + 0x130, 0xAB);
+    ck_assert_int_eq(read_byte_from_memory(&cpu, VIRTUAL_IO_REGISTERS + 0x130), 0xAB);
+    ck_assert_int_eq(first_channel_hits, 1);
+    ck_assert_int_eq(second_channel_hits, 1);
+    remove_request_channel(&cpu, (struct request_channel){.id = 1});
+    read_word_from_memory(&cpu, VIRTUAL_IO_REGISTERS + 0x200);
+    ck_assert_int_eq(second_channel_hits, 2);
+}
+END_TEST
+
+static struct request_data flushed[8];
+static int flushed_count;
+static int flush_calls;
+
+static void queued_channel(struct request_data *data)
+{
+    data->data.word = flushed_count;
+}
+
+static void flush_queued_channel(struct request_data *data, int count)
+{
+    flush_calls++;
+    for (int i = 0; i < count; i++)
+    {
+        flushed[flushed_count++ % 8] = data[i];
+    }
+}
+
+START_TEST(check_queued_channel)
+{
+    ck_assert(add_request_channel(&cpu, (struct request_channel){.name = "queued", .id = 1, .memory_address = VIRTUAL_IO_REGISTERS, .memory_range = 0x100, .push_to_channel = queued_channel, .queue_length = 4, .flush_channel = flush_queued_channel}));
+    flushed_count = 0;
+    flush_calls = 0;
+    write_word_to_memory(&cpu, VIRTUAL_IO_REGISTERS + 0x4, 1);
+    write_half_word_to_memory(&cpu, VIRTUAL_IO_REGISTERS + 0x8, 2);
+    ck_assert_int_eq(flush_calls, 0);
+    // the read sees both stores delivered first, in order
+    ck_assert_int_eq(read_word_from_memory(&cpu, VIRTUAL_IO_REGISTERS), 2);
+    ck_assert_int_eq(flush_calls, 1);
+    ck_assert_int_eq(flushed[0].address, 0x4);
+    ck_assert_int_eq(flushed[1].data.half_word, 2);
+    // a full queue is delivered before it takes the next store
+    for (int i = 0; i < 5; i++)
+    {
+        write_word_to_memory(&cpu, VIRTUAL_IO_REGISTERS + 0x10, i);
+    }
+    ck_assert_int_eq(flush_calls, 2);
+    ck_assert_int_eq(flushed_count, 6);
+    cpu_flush_requests(&cpu);
+    ck_assert_int_eq(flush_calls, 3);
+    ck_assert_int_eq(flushed[6].data.word, 4);
+    cpu_flush_requests(&cpu);
+    ck_assert_int_eq(flush_calls, 3);
+}
+END_TEST
+
+START_TEST(check_load_rom)
+{
+    const char *path = "check_cpu_rom.gba";
+    FILE *f = fopen(path, "wb");
+    ck_assert(f != NULL);
+    // a rom that ends part way into a memory map page
+    BYTE rom[MEMORY_PAGE_SIZE + 0x100] = {0};
+    rom[0] = 0x12;
+    rom[3] = 0x34;
+    memcpy(rom + CARTRIDGE_GAME_CODE, "TEST", CARTRIDGE_GAME_CODE_SIZE);
+    rom[sizeof(rom) - 1] = 0x56;
+    fwrite(rom, sizeof(rom), 1, f);
+    fclose(f);
+    ck_assert(!cpu_load_rom(&cpu, "no such rom.gba"));
+    // the previous game's idle loops do not carry over
+    block_cache_add_idle_override(&cpu.block_cache, 0x300);
+    ck_assert(cpu_load_rom(&cpu, path));
+    remove(path);
+    ck_assert_int_eq(cpu.block_cache.idle_override_count, 0);
+    ck_assert_int_eq(cpu.cartridge.size, sizeof(rom));
+    ck_assert_int_eq(cpu.cartridge.reserved % MEMORY_PAGE_SIZE, 0);
+    ck_assert_int_eq(read_byte_from_memory(&cpu, VIRUTAL_ROM_WAIT_STATE_1), 0x12);
+    ck_assert_int_eq(read_byte_from_memory(&cpu, VIRTUAL_ROM_WAIT_STATE_3 + 3), 0x34);
+    ck_assert_int_eq(read_byte_from_memory(&cpu, VIRTUAL_ROM_WAIT_STATE_2 + sizeof(rom) - 1), 0x56);
+    // past the end of the file the last page reads as zero
+    ck_assert_int_eq(read_word_from_memory(&cpu, VIRUTAL_ROM_WAIT_STATE_1 + sizeof(rom)), 0);
+    write_byte_to_memory(&cpu, VIRUTAL_ROM_WAIT_STATE_1, 0xFF);
+    ck_assert_int_eq(read_byte_from_memory(&cpu, VIRUTAL_ROM_WAIT_STATE_1), 0x12);
+}
+END_TEST
+
+START_TEST(check_dirty_tracking)
+{
+    struct memory_map *map = &cpu.memory_map;
+    ck_assert(memory_map_is_dirty(map, VIRTUAL_VRAM, VRAM_SIZE));
+    memory_map_clear_dirty(map, VIRTUAL_PALLETTE_RAM, PALETTE_SIZE);
+    memory_map_clear_dirty(map, VIRTUAL_VRAM, VRAM_SIZE);
+    memory_map_clear_dirty(map, VIRTUAL_OAM, OAM_SIZE);
+    ck_assert(!memory_map_is_dirty(map, VIRTUAL_VRAM, VRAM_SIZE));
+    write_half_word_to_memory(&cpu, VIRTUAL_PALLETTE_RAM + 0x22, 0x7FFF);
+    ck_assert(memory_map_is_dirty(map, VIRTUAL_PALLETTE_RAM + 0x20, 0x20));
+    ck_assert(!memory_map_is_dirty(map, VIRTUAL_PALLETTE_RAM, 0x20));
+    // the last 32 KB of the vram mirror are the object tiles again
+    write_byte_to_memory(&cpu, VIRTUAL_VRAM + VRAM_SIZE + 0x100, 1);
+    ck_assert(memory_map_is_dirty(map, VIRTUAL_VRAM + 0x10100, 1));
+    ck_assert(!memory_map_is_dirty(map, VIRTUAL_VRAM, 0x10000));
+    write_word_to_memory(&cpu, VIRTUAL_WRAM_BOARD_START, 1);
+    ck_assert(!memory_map_is_dirty(map, VIRTUAL_OAM, OAM_SIZE));
+    // bulk copies mark everything they wrote
+    cpu.registers[R0] = VIRTUAL_WRAM_BOARD_START;
+    cpu.registers[R1] = VIRTUAL_OAM + 0x100;
+    cpu.registers[R2] = 0x40 | (0b1 << 26);
+    gba_cpu_set(&cpu);
+    ck_assert(memory_map_is_dirty(map, VIRTUAL_OAM + 0x1F8, 8));
+    ck_assert(!memory_map_is_dirty(map, VIRTUAL_OAM + 0x200, 8));
+    memory_map_clear_dirty(map, VIRTUAL_OAM, OAM_SIZE);
+    ck_assert(!memory_map_is_dirty(map, VIRTUAL_OAM, OAM_SIZE));
+}
+END_TEST
+
+#ifdef CPU_FASTMEM
+START_TEST(check_fastmem)
+{
+    struct fastmem *fastmem = cpu.memory_map.fastmem;
+    ck_assert_ptr_nonnull(fastmem);
+    // the window and the page table share the same stores, mirrors included
+    write_word_to_memory(&cpu, VIRTUAL_WRAM_CHIP_START + 0x10, 0xCAFEF00D);
+    ck_assert_int_eq(*(WORD *)(fastmem->window + VIRTUAL_WRAM_CHIP_START + IWRAM_SIZE + 0x10), 0xCAFEF00D);
+    ck_assert_int_eq(*(WORD *)memory_map_pointer(&cpu.memory_map, VIRTUAL_WRAM_CHIP_START + 0x10), 0xCAFEF00D);
+    // a mirror smaller than a host page goes straight to the page table, a channel page faults back to it
+    ck_assert(!fastmem_reaches(VIRTUAL_PALLETTE_RAM));
+    ck_assert(fastmem_reaches(VIRTUAL_VRAM));
+    write_half_word_to_memory(&cpu, VIRTUAL_PALLETTE_RAM, 0x1234);
+    ck_assert_int_eq(read_half_word_from_memory(&cpu, VIRTUAL_PALLETTE_RAM + PALETTE_SIZE), 0x1234);
+    add_request_channel(&cpu, (struct request_channel){.name = "test", .id = 1, .memory_address = VIRTUAL_WRAM_BOARD_START, .memory_range = 0x100, .push_to_channel = count_channel_write});
+    channel_writes = 0;
+    write_word_to_memory(&cpu, VIRTUAL_WRAM_BOARD_START, 0x11223344);
+    ck_assert_int_eq(channel_writes, 1);
+    // rom is read only through both paths
+    static BYTE rom[MEMORY_PAGE_SIZE] = {0x78, 0x56, 0x34, 0x12};
+    memory_map_set_rom(&cpu.memory_map, rom, sizeof(rom), -1);
+    ck_assert_int_eq(read_word_from_memory(&cpu, VIRTUAL_ROM_WAIT_STATE_2), 0x12345678);
+    write_word_to_memory(&cpu, VIRUTAL_ROM_WAIT_STATE_1, 0);
+    ck_assert_int_eq(read_word_from_memory(&cpu, VIRUTAL_ROM_WAIT_STATE_1), 0x12345678);
+    // a rom loaded from a file is mapped from it, the tail of its last page reads zero rather than faulting
+    const char *path = "check_fastmem_rom.gba";
+    FILE *f = fopen(path, "wb");
+    ck_assert(f != NULL);
+    BYTE file_rom[MEMORY_PAGE_SIZE + 0x100] = {0x78, 0x56, 0x34, 0x12};
+    file_rom[sizeof(file_rom) - 1] = 0x9A;
+    fwrite(file_rom, sizeof(file_rom), 1, f);
+    fclose(f);
+    ck_assert(cpu_load_rom(&cpu, path));
+    remove(path);
+    ck_assert(fastmem->rom_file);
+    WORD value;
+    ck_assert(fastmem_load_32(fastmem, VIRTUAL_ROM_WAIT_STATE_2, &value));
+    ck_assert_int_eq(value, 0x12345678);
+    ck_assert_int_eq(fastmem->window[VIRUTAL_ROM_WAIT_STATE_1 + sizeof(file_rom) - 1], 0x9A);
+    ck_assert(fastmem_load_32(fastmem, VIRUTAL_ROM_WAIT_STATE_1 + 2 * MEMORY_PAGE_SIZE - 4, &value));
+    ck_assert_int_eq(value, 0);
+}
+END_TEST
+#endif
+
+#ifdef CPU_JIT
+START_TEST(check_jit)
+{
+    if (cpu.jit == NULL)
+    {
+        return;
+    }
+    write_word_to_memory(&cpu, 0x100, 0xE3A00000); // MOV r0, #0
+    write_word_to_memory(&cpu, 0x104, 0xE3A0100A); // MOV r1, #10
+    write_word_to_memory(&cpu, 0x108, 0xE0800001); // ADD r0, r0, r1
+    write_word_to_memory(&cpu, 0x10C, 0xE2511001); // SUBS r1, r1, #1
+    write_word_to_memory(&cpu, 0x110, 0x1AFFFFFC); // BNE 0x108
+    write_word_to_memory(&cpu, 0x114, 0xEAFFFFFE); // B .
+    cpu.registers[PC] = 0x100;
+    jit_run(&cpu, 1000);
+    ck_assert_int_eq(cpu.registers[R0], 55);
+    ck_assert_int_eq(cpu.registers[R1], 0);
+    ck_assert_int_eq(cpu.registers[PC], 0x114);
+    ck_assert(cpu.jit->translated_ops > 0);
+    ck_assert(cpu.jit->chained_links > 0);
+    // patching the loop body has to drop the translated code
+    write_word_to_memory(&cpu, 0x108, 0xE2800002); // ADD r0, r0, #2
+    write_word_to_memory(&cpu, 0x104, 0xE3A01003); // MOV r1, #3
+    cpu.registers[PC] = 0x100;
+    jit_run(&cpu, 1000);
+    ck_assert_int_eq(cpu.registers[R0], 6);
+    // a full length block advances pc past 127 bytes in one go
+    for (int i = 0; i < 32; i++)
+    {
+        write_word_to_memory(&cpu, 0x1000 + i * 4, 0xE3A00001); // MOV r0, #1
+    }
+    write_word_to_memory(&cpu, 0x1080, 0xE3A01007); // MOV r1, #7
+    write_word_to_memory(&cpu, 0x1084, 0xEAFFFFFE); // B .
+    cpu.registers[PC] = 0x1000;
+    jit_run(&cpu, 1000);
+    ck_assert_int_eq(cpu.registers[R1], 7);
+    ck_assert_int_eq(cpu.registers[PC], 0x1084);
+}
+END_TEST
+#endif
+
 int main(void)
 {
     int number_failed = 0;
     SRunner *sr;
     Suite *s = suite_create("CPU");
     TCase *tc_core = tcase_create("Core");
+    tcase_add_checked_fixture(tc_core, setup, teardown);
     tcase_add_test(tc_core, check_overflow);
     tcase_add_test(tc_core, check_read_write);
+    tcase_add_test(tc_core, check_endian_accessors);
+    tcase_add_test(tc_core, check_arm_decode);
+    tcase_add_test(tc_core, check_thumb_decode);
+    tcase_add_test(tc_core, check_block_cache);
+    tcase_add_test(tc_core, check_cpu_run);
+    tcase_add_test(tc_core, check_thumb_run);
+    tcase_add_test(tc_core, check_scheduler);
+    tcase_add_test(tc_core, check_register_banking);
+    tcase_add_test(tc_core, check_lazy_flags);
+    tcase_add_test(tc_core, check_condition_table);
+    tcase_add_test(tc_core, check_idle_loop);
+    tcase_add_test(tc_core, check_hle_syscalls);
+    tcase_add_test(tc_core, check_cpu_set);
+    tcase_add_test(tc_core, check_decompression);
+    tcase_add_test(tc_core, check_affine_set);
+    tcase_add_test(tc_core, check_memory_map);
+    tcase_add_test(tc_core, check_mmio_dispatch);
+    tcase_add_test(tc_core, check_queued_channel);
+    tcase_add_test(tc_core, check_load_rom);
+    tcase_add_test(tc_core, check_dirty_tracking);
+#ifdef CPU_FASTMEM
+    tcase_add_test(tc_core, check_fastmem);
+#endif
+#ifdef CPU_JIT
+    tcase_add_test(tc_core, check_jit);
+#endif
     suite_add_tcase(s, tc_core);
     sr = srunner_create(s);
 